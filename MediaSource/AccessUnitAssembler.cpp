@@ -0,0 +1,289 @@
+#include "pch.h"
+#include "AccessUnitAssembler.h"
+#include "SampleSlices.h"
+#include "StartCodeScanner.h"
+
+static const BYTE s_startCode[3] = { 0, 0, 1 };
+
+AccessUnitAssembler::AccessUnitAssembler(VideoCodec codec, LONGLONG frameDuration)
+    : m_codec(codec), m_frameDuration(frameDuration)
+{
+}
+
+HRESULT AccessUnitAssembler::Push(IMFMediaBuffer* pBuffer, LONGLONG time)
+{
+    if (pBuffer == NULL)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+    winrt::com_ptr<IUnknown> owner;
+    BYTE* data = nullptr;
+    DWORD length = 0;
+    CHECK_HR(hr = SampleSlices::LockBuffer(pBuffer, owner.put(), &data, &length));
+
+    // A start code may begin in the previous chunk. Its zeros were added to
+    // the previous NAL unit; take them back and use a whole start code.
+    DWORD pos = 0;
+    if (m_zeroRun >= 2 && length >= 1 && data[0] == 1)
+    {
+        pos = 1;
+    }
+    else if (m_zeroRun >= 1 && length >= 2 && data[0] == 0 && data[1] == 1)
+    {
+        pos = 2;
+    }
+
+    if (pos != 0)
+    {
+        TrimTail(3 - pos);
+        CHECK_HR(hr = BeginNalUnit());
+
+        // Slices may be written by whoever receives them, so the start code
+        // they point at is a copy the assembler owns.
+        if (m_startCode == nullptr)
+        {
+            CHECK_HR(hr = MemorySlab::Create(sizeof(s_startCode), NUMA_NO_PREFERRED_NODE, m_startCode.put()));
+            memcpy(m_startCode->Data(), s_startCode, sizeof(s_startCode));
+        }
+        AddSpan(m_startCode.get(), m_startCode->Data(), sizeof(s_startCode));
+        CHECK_HR(hr = CollectHeader(data + pos, length - pos));
+    }
+    else if (m_headerPending)
+    {
+        CHECK_HR(hr = CollectHeader(data, length));
+    }
+
+    // A NAL unit that began in an earlier chunk opens its access unit with
+    // that chunk's time, so this chunk's time only applies from here on. A
+    // chunk too short to finish the header cannot start anything else.
+    if (time != AU_NO_TIMESTAMP && !m_headerPending)
+    {
+        m_pendingTime = time;
+    }
+
+    DWORD segment = pos;
+    while (pos < length)
+    {
+        DWORD found = (DWORD)StartCodeScanner::Find(data + pos, length - pos);
+        if (found == length - pos)
+        {
+            break;
+        }
+        DWORD at = pos + found;
+
+        if (m_inNalUnit && at > segment)
+        {
+            AddSpan(owner.get(), data + segment, at - segment);
+        }
+        CHECK_HR(hr = BeginNalUnit());
+        segment = at;
+        pos = at + 3;
+        CHECK_HR(hr = CollectHeader(data + pos, length - pos));
+    }
+
+    if (m_inNalUnit && length > segment)
+    {
+        AddSpan(owner.get(), data + segment, length - segment);
+    }
+
+    DWORD zeros = 0;
+    while (zeros < length && data[length - 1 - zeros] == 0)
+    {
+        zeros++;
+    }
+    m_zeroRun = zeros == length ? m_zeroRun + zeros : zeros;
+    return hr;
+}
+
+HRESULT AccessUnitAssembler::Flush()
+{
+    HRESULT hr = S_OK;
+    if (m_headerPending)
+    {
+        CHECK_HR(hr = ClassifyNalUnit());
+    }
+    CHECK_HR(hr = EmitAccessUnit(m_spans.size()));
+    m_inNalUnit = false;
+    m_zeroRun = 0;
+    return hr;
+}
+
+HRESULT AccessUnitAssembler::GetNext(IMFSample** ppSample)
+{
+    if (ppSample == NULL)
+    {
+        return E_POINTER;
+    }
+    if (m_ready.empty())
+    {
+        return S_FALSE;
+    }
+    *ppSample = m_ready.front().detach();
+    m_ready.pop();
+    return S_OK;
+}
+
+void AccessUnitAssembler::Reset()
+{
+    m_spans.clear();
+    m_nalStart = 0;
+    m_inNalUnit = false;
+    m_headerLength = 0;
+    m_headerPending = false;
+    m_zeroRun = 0;
+    m_auHasVcl = false;
+    m_auCleanPoint = false;
+    m_pendingTime = AU_NO_TIMESTAMP;
+    m_nextTime = 0;
+    while (!m_ready.empty())
+    {
+        m_ready.pop();
+    }
+}
+
+void AccessUnitAssembler::AddSpan(IUnknown* pOwner, BYTE* pData, DWORD length)
+{
+    Span span;
+    span.owner.copy_from(pOwner);
+    span.data = pData;
+    span.length = length;
+    m_spans.push_back(span);
+}
+
+// Drop bytes from the end of the NAL unit being scanned.
+void AccessUnitAssembler::TrimTail(DWORD length)
+{
+    while (length > 0 && m_spans.size() > m_nalStart)
+    {
+        Span& last = m_spans.back();
+        if (last.length > length)
+        {
+            last.length -= length;
+            return;
+        }
+        length -= last.length;
+        m_spans.pop_back();
+    }
+}
+
+HRESULT AccessUnitAssembler::BeginNalUnit()
+{
+    HRESULT hr = S_OK;
+
+    // A NAL unit too short to classify stays with the current access unit.
+    if (m_headerPending)
+    {
+        CHECK_HR(hr = ClassifyNalUnit());
+    }
+    if (!m_inNalUnit)
+    {
+        m_inNalUnit = true;
+        BeginAccessUnit();
+    }
+    m_nalStart = m_spans.size();
+    m_headerLength = 0;
+    m_headerPending = true;
+    return hr;
+}
+
+void AccessUnitAssembler::BeginAccessUnit()
+{
+    m_auTime = m_pendingTime != AU_NO_TIMESTAMP ? m_pendingTime : m_nextTime;
+    m_pendingTime = AU_NO_TIMESTAMP;
+    m_auHasVcl = false;
+    m_auCleanPoint = false;
+}
+
+// H.264 needs the NAL header and the first slice header byte, HEVC its
+// two-byte NAL header and the first slice header byte.
+HRESULT AccessUnitAssembler::CollectHeader(const BYTE* pData, DWORD length)
+{
+    DWORD needed = m_codec == VideoCodec::H264 ? 2 : 3;
+    while (m_headerLength < needed && length > 0)
+    {
+        m_header[m_headerLength++] = *pData++;
+        length--;
+    }
+    if (m_headerLength == needed)
+    {
+        return ClassifyNalUnit();
+    }
+    return S_OK;
+}
+
+HRESULT AccessUnitAssembler::ClassifyNalUnit()
+{
+    HRESULT hr = S_OK;
+    bool vcl = false;
+    bool firstSlice = false;
+    bool prefix = false;
+    bool cleanPoint = false;
+    m_headerPending = false;
+
+    if (m_codec == VideoCodec::H264)
+    {
+        if (m_headerLength < 1)
+        {
+            return S_OK;
+        }
+        BYTE type = m_header[0] & 0x1F;
+        vcl = type >= 1 && type <= 5;
+        // first_mb_in_slice == 0 is coded as a single 1 bit.
+        firstSlice = vcl && m_headerLength >= 2 && (m_header[1] & 0x80) != 0;
+        prefix = (type >= 6 && type <= 9) || (type >= 14 && type <= 18);
+        cleanPoint = type == 5;
+    }
+    else
+    {
+        if (m_headerLength < 2)
+        {
+            return S_OK;
+        }
+        BYTE type = (m_header[0] >> 1) & 0x3F;
+        vcl = type < 32;
+        firstSlice = vcl && m_headerLength >= 3 && (m_header[2] & 0x80) != 0;
+        prefix = (type >= 32 && type <= 35) || type == 39 || (type >= 41 && type <= 44) || (type >= 48 && type <= 55);
+        cleanPoint = type >= 16 && type <= 23;
+    }
+
+    // Parameter sets, SEI and delimiters open the next access unit, as does
+    // the first slice of a picture.
+    if (m_auHasVcl && (prefix || firstSlice))
+    {
+        CHECK_HR(hr = EmitAccessUnit(m_nalStart));
+        BeginAccessUnit();
+    }
+    m_auHasVcl = m_auHasVcl || vcl;
+    m_auCleanPoint = m_auCleanPoint || cleanPoint;
+    return hr;
+}
+
+HRESULT AccessUnitAssembler::EmitAccessUnit(size_t spanCount)
+{
+    if (spanCount == 0)
+    {
+        return S_OK;
+    }
+
+    HRESULT hr = S_OK;
+    winrt::com_ptr<IMFSample> sample;
+    CHECK_HR(hr = MFCreateSample(sample.put()));
+    for (size_t i = 0; i < spanCount; i++)
+    {
+        CHECK_HR(hr = SampleSlices::AddSlice(sample.get(), m_spans[i].owner.get(), m_spans[i].data, m_spans[i].length));
+    }
+    CHECK_HR(hr = sample->SetSampleTime(m_auTime));
+    CHECK_HR(hr = sample->SetSampleDuration(m_frameDuration));
+    if (m_auCleanPoint)
+    {
+        CHECK_HR(hr = sample->SetUINT32(MFSampleExtension_CleanPoint, TRUE));
+    }
+    m_ready.push(sample);
+
+    m_spans.erase(m_spans.begin(), m_spans.begin() + spanCount);
+    m_nalStart -= spanCount < m_nalStart ? spanCount : m_nalStart;
+    m_nextTime = m_auTime + m_frameDuration;
+    return hr;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <mfapi.h>
+#include <queue>
+#include <vector>
+#include "MemoryBuffer.h"
+
+enum class VideoCodec
+{
+    H264,
+    HEVC
+};
+
+const LONGLONG AU_NO_TIMESTAMP = -1;
+
+// Splits an Annex-B elementary stream into access units. Input arrives in
+// arbitrary chunks; each access unit is a scatter-gather sample whose
+// buffers are slices of the input, so nothing is copied even when a NAL
+// unit or start code straddles two chunks. IDR/IRAP access units are
+// marked as clean points.
+class AccessUnitAssembler
+{
+public:
+    AccessUnitAssembler(VideoCodec codec, LONGLONG frameDuration);
+
+    // time is the timestamp of the first access unit that starts in this
+    // chunk, or AU_NO_TIMESTAMP to follow on from the previous one.
+    HRESULT Push(IMFMediaBuffer* pBuffer, LONGLONG time);
+
+    // End of stream: complete the access unit in progress.
+    HRESULT Flush();
+
+    // S_FALSE when no complete access unit is ready.
+    HRESULT GetNext(IMFSample** ppSample);
+
+    void Reset();
+
+private:
+    struct Span
+    {
+        winrt::com_ptr<IUnknown> owner;
+        BYTE* data;
+        DWORD length;
+    };
+
+    void AddSpan(IUnknown* pOwner, BYTE* pData, DWORD length);
+    void TrimTail(DWORD length);
+    HRESULT BeginNalUnit();
+    void BeginAccessUnit();
+    HRESULT CollectHeader(const BYTE* pData, DWORD length);
+    HRESULT ClassifyNalUnit();
+    HRESULT EmitAccessUnit(size_t spanCount);
+
+    VideoCodec m_codec;
+    LONGLONG m_frameDuration;
+
+    std::vector<Span> m_spans;      // Access unit in progress, start codes included.
+    size_t m_nalStart = 0;          // First span of the NAL unit being scanned.
+    bool m_inNalUnit = false;       // Bytes before the first start code are dropped.
+    BYTE m_header[3] = {};
+    DWORD m_headerLength = 0;
+    bool m_headerPending = false;
+    DWORD m_zeroRun = 0;            // Trailing zero bytes of the previous chunk.
+    winrt::com_ptr<MemorySlab> m_startCode; // Start code for one split across chunks, made on first use.
+
+    bool m_auHasVcl = false;
+    bool m_auCleanPoint = false;
+    LONGLONG m_auTime = 0;
+    LONGLONG m_pendingTime = AU_NO_TIMESTAMP;
+    LONGLONG m_nextTime = 0;
+
+    std::queue<winrt::com_ptr<IMFSample>> m_ready;
+};
@@ -0,0 +1,351 @@
+#include "pch.h"
+#include "AesCipher.h"
+#include <intrin.h>
+#include <wmmintrin.h>
+
+static const BYTE s_sbox[256] =
+{
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+static const BYTE s_invSbox[256] =
+{
+    0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
+    0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
+    0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
+    0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
+    0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
+    0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
+    0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
+    0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
+    0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
+    0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
+    0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
+    0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
+    0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
+    0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
+    0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
+    0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d,
+};
+
+static BYTE XTime(BYTE x)
+{
+    return (BYTE)((x << 1) ^ ((x & 0x80) != 0 ? 0x1b : 0));
+}
+
+static BYTE Multiply(BYTE x, BYTE y)
+{
+    BYTE result = 0;
+    while (y != 0)
+    {
+        if ((y & 1) != 0)
+        {
+            result ^= x;
+        }
+        x = XTime(x);
+        y >>= 1;
+    }
+    return result;
+}
+
+// Byte-oriented FIPS-197 cipher. The state is column-major: byte c * 4 + r
+// is row r of column c.
+static void EncryptScalar(const BYTE keys[11][16], const BYTE in[16], BYTE out[16])
+{
+    BYTE state[16];
+    for (int i = 0; i < 16; i++)
+    {
+        state[i] = in[i] ^ keys[0][i];
+    }
+    for (int round = 1; round <= 10; round++)
+    {
+        BYTE t[16];
+        for (int c = 0; c < 4; c++)
+        {
+            for (int r = 0; r < 4; r++)
+            {
+                t[c * 4 + r] = s_sbox[state[((c + r) % 4) * 4 + r]];
+            }
+        }
+        if (round < 10)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                BYTE* col = t + c * 4;
+                BYTE a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+                col[0] = XTime(a0) ^ XTime(a1) ^ a1 ^ a2 ^ a3;
+                col[1] = a0 ^ XTime(a1) ^ XTime(a2) ^ a2 ^ a3;
+                col[2] = a0 ^ a1 ^ XTime(a2) ^ XTime(a3) ^ a3;
+                col[3] = XTime(a0) ^ a0 ^ a1 ^ a2 ^ XTime(a3);
+            }
+        }
+        for (int i = 0; i < 16; i++)
+        {
+            state[i] = t[i] ^ keys[round][i];
+        }
+    }
+    memcpy(out, state, 16);
+}
+
+static void DecryptScalar(const BYTE keys[11][16], const BYTE in[16], BYTE out[16])
+{
+    BYTE state[16];
+    for (int i = 0; i < 16; i++)
+    {
+        state[i] = in[i] ^ keys[10][i];
+    }
+    for (int round = 9; round >= 0; round--)
+    {
+        BYTE t[16];
+        for (int c = 0; c < 4; c++)
+        {
+            for (int r = 0; r < 4; r++)
+            {
+                t[c * 4 + r] = s_invSbox[state[((c - r + 4) % 4) * 4 + r]] ^ keys[round][c * 4 + r];
+            }
+        }
+        if (round > 0)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                BYTE* col = t + c * 4;
+                BYTE a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+                col[0] = Multiply(a0, 14) ^ Multiply(a1, 11) ^ Multiply(a2, 13) ^ Multiply(a3, 9);
+                col[1] = Multiply(a0, 9) ^ Multiply(a1, 14) ^ Multiply(a2, 11) ^ Multiply(a3, 13);
+                col[2] = Multiply(a0, 13) ^ Multiply(a1, 9) ^ Multiply(a2, 14) ^ Multiply(a3, 11);
+                col[3] = Multiply(a0, 11) ^ Multiply(a1, 13) ^ Multiply(a2, 9) ^ Multiply(a3, 14);
+            }
+        }
+        memcpy(state, t, 16);
+    }
+    memcpy(out, state, 16);
+}
+
+// AES-NI encrypts four independent blocks at a time so the AESENC latency
+// overlaps; CTR blocks never depend on each other, nor do CBC decryptions.
+static __m128i EncryptAesNi(const __m128i* keys, __m128i block)
+{
+    block = _mm_xor_si128(block, keys[0]);
+    for (int round = 1; round < 10; round++)
+    {
+        block = _mm_aesenc_si128(block, keys[round]);
+    }
+    return _mm_aesenclast_si128(block, keys[10]);
+}
+
+static __m128i CounterBlock(ULONGLONG prefix, ULONGLONG count)
+{
+    return _mm_set_epi64x((long long)_byteswap_uint64(count), (long long)prefix);
+}
+
+static void CtrXorAesNi(const BYTE keys[11][16], BYTE counter[16], BYTE* pData, size_t blocks)
+{
+    __m128i k[11];
+    for (int i = 0; i < 11; i++)
+    {
+        k[i] = _mm_load_si128((const __m128i*)keys[i]);
+    }
+    ULONGLONG prefix;
+    ULONGLONG count;
+    memcpy(&prefix, counter, 8);
+    memcpy(&count, counter + 8, 8);
+    count = _byteswap_uint64(count);
+
+    size_t i = 0;
+    for (; i + 4 <= blocks; i += 4)
+    {
+        __m128i b0 = _mm_xor_si128(CounterBlock(prefix, count), k[0]);
+        __m128i b1 = _mm_xor_si128(CounterBlock(prefix, count + 1), k[0]);
+        __m128i b2 = _mm_xor_si128(CounterBlock(prefix, count + 2), k[0]);
+        __m128i b3 = _mm_xor_si128(CounterBlock(prefix, count + 3), k[0]);
+        for (int round = 1; round < 10; round++)
+        {
+            b0 = _mm_aesenc_si128(b0, k[round]);
+            b1 = _mm_aesenc_si128(b1, k[round]);
+            b2 = _mm_aesenc_si128(b2, k[round]);
+            b3 = _mm_aesenc_si128(b3, k[round]);
+        }
+        __m128i* data = (__m128i*)(pData + i * 16);
+        _mm_storeu_si128(data, _mm_xor_si128(_mm_loadu_si128(data), _mm_aesenclast_si128(b0, k[10])));
+        _mm_storeu_si128(data + 1, _mm_xor_si128(_mm_loadu_si128(data + 1), _mm_aesenclast_si128(b1, k[10])));
+        _mm_storeu_si128(data + 2, _mm_xor_si128(_mm_loadu_si128(data + 2), _mm_aesenclast_si128(b2, k[10])));
+        _mm_storeu_si128(data + 3, _mm_xor_si128(_mm_loadu_si128(data + 3), _mm_aesenclast_si128(b3, k[10])));
+        count += 4;
+    }
+    for (; i < blocks; i++)
+    {
+        __m128i* data = (__m128i*)(pData + i * 16);
+        _mm_storeu_si128(data, _mm_xor_si128(_mm_loadu_si128(data), EncryptAesNi(k, CounterBlock(prefix, count))));
+        count++;
+    }
+
+    count = _byteswap_uint64(count);
+    memcpy(counter + 8, &count, 8);
+}
+
+static void CbcDecryptAesNi(const BYTE keys[11][16], BYTE iv[16], BYTE* pData, size_t blocks)
+{
+    __m128i k[11];
+    for (int i = 0; i < 11; i++)
+    {
+        k[i] = _mm_load_si128((const __m128i*)keys[i]);
+    }
+    __m128i previous = _mm_loadu_si128((const __m128i*)iv);
+
+    size_t i = 0;
+    for (; i + 4 <= blocks; i += 4)
+    {
+        __m128i* data = (__m128i*)(pData + i * 16);
+        __m128i c0 = _mm_loadu_si128(data);
+        __m128i c1 = _mm_loadu_si128(data + 1);
+        __m128i c2 = _mm_loadu_si128(data + 2);
+        __m128i c3 = _mm_loadu_si128(data + 3);
+        __m128i b0 = _mm_xor_si128(c0, k[0]);
+        __m128i b1 = _mm_xor_si128(c1, k[0]);
+        __m128i b2 = _mm_xor_si128(c2, k[0]);
+        __m128i b3 = _mm_xor_si128(c3, k[0]);
+        for (int round = 1; round < 10; round++)
+        {
+            b0 = _mm_aesdec_si128(b0, k[round]);
+            b1 = _mm_aesdec_si128(b1, k[round]);
+            b2 = _mm_aesdec_si128(b2, k[round]);
+            b3 = _mm_aesdec_si128(b3, k[round]);
+        }
+        _mm_storeu_si128(data, _mm_xor_si128(_mm_aesdeclast_si128(b0, k[10]), previous));
+        _mm_storeu_si128(data + 1, _mm_xor_si128(_mm_aesdeclast_si128(b1, k[10]), c0));
+        _mm_storeu_si128(data + 2, _mm_xor_si128(_mm_aesdeclast_si128(b2, k[10]), c1));
+        _mm_storeu_si128(data + 3, _mm_xor_si128(_mm_aesdeclast_si128(b3, k[10]), c2));
+        previous = c3;
+    }
+    for (; i < blocks; i++)
+    {
+        __m128i* data = (__m128i*)(pData + i * 16);
+        __m128i c = _mm_loadu_si128(data);
+        __m128i b = _mm_xor_si128(c, k[0]);
+        for (int round = 1; round < 10; round++)
+        {
+            b = _mm_aesdec_si128(b, k[round]);
+        }
+        _mm_storeu_si128(data, _mm_xor_si128(_mm_aesdeclast_si128(b, k[10]), previous));
+        previous = c;
+    }
+    _mm_storeu_si128((__m128i*)iv, previous);
+}
+
+AesCipher::AesCipher(const BYTE key[16], bool useAesNi)
+    : m_aesNi(useAesNi && CpuFeatures::HasAesNi())
+{
+    // FIPS-197 key expansion, four bytes per word.
+    BYTE* words = &m_encrypt[0][0];
+    memcpy(words, key, 16);
+    BYTE rcon = 1;
+    for (int i = 4; i < 44; i++)
+    {
+        BYTE t[4];
+        memcpy(t, words + (i - 1) * 4, 4);
+        if (i % 4 == 0)
+        {
+            BYTE first = t[0];
+            t[0] = s_sbox[t[1]] ^ rcon;
+            t[1] = s_sbox[t[2]];
+            t[2] = s_sbox[t[3]];
+            t[3] = s_sbox[first];
+            rcon = XTime(rcon);
+        }
+        for (int j = 0; j < 4; j++)
+        {
+            words[i * 4 + j] = words[(i - 4) * 4 + j] ^ t[j];
+        }
+    }
+
+    if (m_aesNi)
+    {
+        _mm_store_si128((__m128i*)m_decrypt[0], _mm_load_si128((const __m128i*)m_encrypt[10]));
+        for (int round = 1; round < 10; round++)
+        {
+            _mm_store_si128((__m128i*)m_decrypt[round], _mm_aesimc_si128(_mm_load_si128((const __m128i*)m_encrypt[10 - round])));
+        }
+        _mm_store_si128((__m128i*)m_decrypt[10], _mm_load_si128((const __m128i*)m_encrypt[0]));
+    }
+}
+
+void AesCipher::CtrXor(BYTE counter[16], BYTE* pData, size_t blocks) const
+{
+    if (m_aesNi)
+    {
+        CtrXorAesNi(m_encrypt, counter, pData, blocks);
+        return;
+    }
+    for (size_t i = 0; i < blocks; i++)
+    {
+        BYTE keystream[16];
+        EncryptScalar(m_encrypt, counter, keystream);
+        for (int j = 0; j < 16; j++)
+        {
+            pData[i * 16 + j] ^= keystream[j];
+        }
+        IncrementCounter(counter);
+    }
+}
+
+void AesCipher::CbcDecrypt(BYTE iv[16], BYTE* pData, size_t blocks) const
+{
+    if (m_aesNi)
+    {
+        CbcDecryptAesNi(m_decrypt, iv, pData, blocks);
+        return;
+    }
+    for (size_t i = 0; i < blocks; i++)
+    {
+        BYTE* block = pData + i * 16;
+        BYTE ciphertext[16];
+        memcpy(ciphertext, block, 16);
+        DecryptScalar(m_encrypt, ciphertext, block);
+        for (int j = 0; j < 16; j++)
+        {
+            block[j] ^= iv[j];
+        }
+        memcpy(iv, ciphertext, 16);
+    }
+}
+
+void AesCipher::EncryptBlock(const BYTE in[16], BYTE out[16]) const
+{
+    if (m_aesNi)
+    {
+        __m128i k[11];
+        for (int i = 0; i < 11; i++)
+        {
+            k[i] = _mm_load_si128((const __m128i*)m_encrypt[i]);
+        }
+        _mm_storeu_si128((__m128i*)out, EncryptAesNi(k, _mm_loadu_si128((const __m128i*)in)));
+        return;
+    }
+    EncryptScalar(m_encrypt, in, out);
+}
+
+void AesCipher::IncrementCounter(BYTE counter[16])
+{
+    for (int i = 15; i >= 8; i--)
+    {
+        if (++counter[i] != 0)
+        {
+            break;
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "CpuFeatures.h"
+
+const DWORD AES_BLOCK_SIZE = 16;
+
+// AES-128 in the two modes Common Encryption uses, working in place on whole
+// blocks. Uses AES-NI when asked and available; the scalar code is both the
+// fallback and the reference the AES-NI path is measured against.
+class AesCipher
+{
+public:
+    AesCipher(const BYTE key[16], bool useAesNi = CpuFeatures::HasAesNi());
+
+    // XOR the keystream for blocks counter blocks into pData. The low 64 bits
+    // of counter are a big-endian block count; counter is left at the next
+    // unused block.
+    void CtrXor(BYTE counter[16], BYTE* pData, size_t blocks) const;
+
+    // Decrypt blocks in place. iv is left at the last ciphertext block, so a
+    // chain can continue across calls.
+    void CbcDecrypt(BYTE iv[16], BYTE* pData, size_t blocks) const;
+
+    void EncryptBlock(const BYTE in[16], BYTE out[16]) const;
+    bool UsesAesNi() const { return m_aesNi; }
+
+    static void IncrementCounter(BYTE counter[16]);
+
+private:
+    alignas(16) BYTE m_encrypt[11][16];
+    alignas(16) BYTE m_decrypt[11][16];     // Equivalent inverse cipher keys for AESDEC.
+    bool m_aesNi;
+};
@@ -0,0 +1,226 @@
+#include "pch.h"
+#include "AsyncFile.h"
+#include <new>
+
+volatile LONGLONG AsyncFile::s_reads = 0;
+volatile LONGLONG AsyncFile::s_bytesRead = 0;
+
+// Each outstanding read holds a reference to its file, so the file cannot go
+// away while the thread pool still owns a callback for it.
+struct FileRead : OVERLAPPED
+{
+    winrt::com_ptr<AsyncFile> file;
+    BYTE* data;
+    DWORD length;
+    IoCompletion completion;
+};
+
+static FileRead* CreateFileRead(AsyncFile* pFile, ULONGLONG offset, BYTE* pData, DWORD length, IoCompletion& completion)
+{
+    FileRead* read = new (std::nothrow) FileRead();
+    if (read != nullptr)
+    {
+        read->Offset = (DWORD)offset;
+        read->OffsetHigh = (DWORD)(offset >> 32);
+        read->file.copy_from(pFile);
+        read->data = pData;
+        read->length = length;
+        read->completion = completion;
+    }
+    return read;
+}
+
+static HRESULT GetFileSize(HANDLE file, ULONGLONG* pSize)
+{
+    if (pSize == NULL)
+    {
+        return E_POINTER;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    *pSize = (ULONGLONG)size.QuadPart;
+    return S_OK;
+}
+
+// Reads are issued from the caller's thread and complete on the thread
+// pool's I/O completion port; no thread waits on them.
+class OverlappedFile : public AsyncFile
+{
+public:
+    OverlappedFile(HANDLE file) : m_file(file)
+    {
+    }
+
+    ~OverlappedFile()
+    {
+        if (m_io != NULL)
+        {
+            CloseThreadpoolIo(m_io);
+        }
+        CloseHandle(m_file);
+    }
+
+    HRESULT Initialize()
+    {
+        m_io = CreateThreadpoolIo(m_file, OnIoComplete, NULL, NULL);
+        if (m_io == NULL)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        return S_OK;
+    }
+
+    HRESULT ReadAt(ULONGLONG offset, BYTE* pData, DWORD length, IoCompletion completion)
+    {
+        FileRead* read = CreateFileRead(this, offset, pData, length, completion);
+        if (read == nullptr)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        StartThreadpoolIo(m_io);
+        if (!ReadFile(m_file, pData, length, NULL, read))
+        {
+            DWORD error = GetLastError();
+            if (error != ERROR_IO_PENDING)
+            {
+                CancelThreadpoolIo(m_io);
+                delete read;
+                return HRESULT_FROM_WIN32(error);
+            }
+        }
+        return S_OK;
+    }
+
+    HRESULT GetSize(ULONGLONG* pSize)
+    {
+        return GetFileSize(m_file, pSize);
+    }
+
+private:
+    static VOID CALLBACK OnIoComplete(PTP_CALLBACK_INSTANCE, PVOID, PVOID pOverlapped, ULONG ioResult, ULONG_PTR bytesTransferred, PTP_IO)
+    {
+        FileRead* read = (FileRead*)pOverlapped;
+        CountRead((DWORD)bytesTransferred);
+        read->completion(ioResult == NO_ERROR ? S_OK : HRESULT_FROM_WIN32(ioResult), (DWORD)bytesTransferred);
+        delete read;
+    }
+
+    HANDLE m_file;
+    PTP_IO m_io = NULL;
+};
+
+// Fallback for handles that cannot be bound to the I/O port: each read runs
+// on a thread pool worker and blocks it until the data arrives.
+class ThreadPoolFile : public AsyncFile
+{
+public:
+    ThreadPoolFile(HANDLE file) : m_file(file)
+    {
+    }
+
+    ~ThreadPoolFile()
+    {
+        CloseHandle(m_file);
+    }
+
+    HRESULT ReadAt(ULONGLONG offset, BYTE* pData, DWORD length, IoCompletion completion)
+    {
+        FileRead* read = CreateFileRead(this, offset, pData, length, completion);
+        if (read == nullptr)
+        {
+            return E_OUTOFMEMORY;
+        }
+        if (!TrySubmitThreadpoolCallback(OnRead, read, NULL))
+        {
+            DWORD error = GetLastError();
+            delete read;
+            return HRESULT_FROM_WIN32(error);
+        }
+        return S_OK;
+    }
+
+    HRESULT GetSize(ULONGLONG* pSize)
+    {
+        return GetFileSize(m_file, pSize);
+    }
+
+private:
+    static VOID CALLBACK OnRead(PTP_CALLBACK_INSTANCE, PVOID pContext)
+    {
+        FileRead* read = (FileRead*)pContext;
+        ThreadPoolFile* file = (ThreadPoolFile*)read->file.get();
+        HRESULT hr = S_OK;
+        DWORD bytesRead = 0;
+
+        // The handle is opened for overlapped I/O so reads on different
+        // workers do not serialise on the file object; wait on a private event.
+        read->hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+        if (read->hEvent == NULL)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+        else
+        {
+            if (!ReadFile(file->m_file, read->data, read->length, NULL, read) && GetLastError() != ERROR_IO_PENDING)
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+            }
+            else if (!GetOverlappedResult(file->m_file, read, &bytesRead, TRUE))
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+            }
+            CloseHandle(read->hEvent);
+        }
+
+        CountRead(bytesRead);
+        read->completion(hr, bytesRead);
+        delete read;
+    }
+
+    HANDLE m_file;
+};
+
+HRESULT AsyncFile::Open(LPCWSTR path, IoBackend backend, AsyncFile** ppFile)
+{
+    if (path == NULL || ppFile == NULL)
+    {
+        return E_POINTER;
+    }
+
+    HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    HRESULT hr = S_OK;
+    if (backend == IoBackend::OVERLAPPED)
+    {
+        auto overlapped = winrt::make_self<OverlappedFile>(file);
+        CHECK_HR(hr = overlapped->Initialize());
+        *ppFile = overlapped.detach();
+    }
+    else
+    {
+        auto pooled = winrt::make_self<ThreadPoolFile>(file);
+        *ppFile = pooled.detach();
+    }
+    return hr;
+}
+
+void AsyncFile::CountRead(DWORD bytesRead)
+{
+    InterlockedIncrement64(&s_reads);
+    InterlockedAdd64(&s_bytesRead, bytesRead);
+}
+
+void AsyncFile::GetCounters(IoCounters* pCounters)
+{
+    pCounters->reads = s_reads;
+    pCounters->bytesRead = s_bytesRead;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <mfapi.h>
+#include <functional>
+
+enum class IoBackend
+{
+    OVERLAPPED,     // Overlapped reads completed on the thread pool's I/O port.
+    THREAD_POOL     // Blocking positional reads on thread pool workers.
+};
+
+struct IoCounters
+{
+    LONGLONG reads;         // Reads completed, successful or not.
+    LONGLONG bytesRead;
+};
+
+// Called once per read, on an I/O thread.
+typedef std::function<void(HRESULT hr, DWORD bytesRead)> IoCompletion;
+
+// Positional reads that complete asynchronously. Any number of reads may be
+// outstanding; the caller keeps pData valid until the completion runs.
+class AsyncFile : public winrt::implements<AsyncFile, IUnknown>
+{
+public:
+    static HRESULT Open(LPCWSTR path, IoBackend backend, AsyncFile** ppFile);
+
+    virtual ~AsyncFile() = default;
+
+    virtual HRESULT ReadAt(ULONGLONG offset, BYTE* pData, DWORD length, IoCompletion completion) = 0;
+    virtual HRESULT GetSize(ULONGLONG* pSize) = 0;
+
+    static void GetCounters(IoCounters* pCounters);
+
+protected:
+    static void CountRead(DWORD bytesRead);
+
+private:
+    static volatile LONGLONG s_reads;
+    static volatile LONGLONG s_bytesRead;
+};
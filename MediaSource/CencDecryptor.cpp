@@ -0,0 +1,446 @@
+#include "pch.h"
+#include "CencDecryptor.h"
+#include <mferror.h>
+#include <algorithm>
+#include "SampleSlices.h"
+
+static const GUID* const s_encryptionAttributes[] =
+{
+    &MFSampleExtension_Encryption_ProtectionScheme,
+    &MFSampleExtension_Encryption_KeyID,
+    &MFSampleExtension_Encryption_SampleID,
+    &MFSampleExtension_Encryption_SubSample_Mapping,
+    &MFSampleExtension_Encryption_CryptByteBlock,
+    &MFSampleExtension_Encryption_SkipByteBlock,
+};
+
+// CTR keystream position, carried across the protected ranges of a sample.
+struct CtrState
+{
+    BYTE counter[16];
+    BYTE keystream[16];
+    DWORD used = AES_BLOCK_SIZE;
+};
+
+static void CtrRange(const AesCipher& cipher, CtrState& state, BYTE* pData, size_t length)
+{
+    while (length > 0 && state.used < AES_BLOCK_SIZE)
+    {
+        *pData++ ^= state.keystream[state.used++];
+        length--;
+    }
+
+    size_t blocks = length / AES_BLOCK_SIZE;
+    cipher.CtrXor(state.counter, pData, blocks);
+    pData += blocks * AES_BLOCK_SIZE;
+    length -= blocks * AES_BLOCK_SIZE;
+
+    if (length > 0)
+    {
+        cipher.EncryptBlock(state.counter, state.keystream);
+        AesCipher::IncrementCounter(state.counter);
+        state.used = 0;
+        while (length > 0)
+        {
+            *pData++ ^= state.keystream[state.used++];
+            length--;
+        }
+    }
+}
+
+CencDecryptor::CencDecryptor(bool useAesNi)
+    : m_aesNi(useAesNi && CpuFeatures::HasAesNi())
+{
+    InitializeCriticalSection(&m_critSec);
+}
+
+CencDecryptor::~CencDecryptor()
+{
+    DeleteCriticalSection(&m_critSec);
+}
+
+HRESULT CencDecryptor::AddKey(const GUID& keyId, const BYTE key[16])
+{
+    if (key == NULL)
+    {
+        return E_POINTER;
+    }
+
+    auto cipher = std::make_unique<AesCipher>(key, m_aesNi);
+    EnterCriticalSection(&m_critSec);
+    HRESULT hr = S_OK;
+    bool found = false;
+    for (auto& entry : m_keys)
+    {
+        if (entry.first == keyId)
+        {
+            found = true;
+            break;
+        }
+    }
+    if (found)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+    }
+    else
+    {
+        m_keys.emplace_back(keyId, std::move(cipher));
+    }
+    LeaveCriticalSection(&m_critSec);
+    return hr;
+}
+
+const AesCipher* CencDecryptor::FindCipher(const GUID& keyId)
+{
+    const AesCipher* cipher = nullptr;
+    EnterCriticalSection(&m_critSec);
+    for (auto& entry : m_keys)
+    {
+        if (entry.first == keyId)
+        {
+            cipher = entry.second.get();
+            break;
+        }
+    }
+    if (cipher == nullptr && keyId == GUID_NULL && !m_keys.empty())
+    {
+        cipher = m_keys.front().second.get();
+    }
+    LeaveCriticalSection(&m_critSec);
+    return cipher;
+}
+
+HRESULT CencDecryptor::Decrypt(IMFSample* pSample, SamplePool* pPool, IMFSample** ppSample)
+{
+    if (pSample == NULL || ppSample == NULL)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+    UINT32 scheme = MFGetAttributeUINT32(pSample, MFSampleExtension_Encryption_ProtectionScheme, MF_SAMPLE_ENCRYPTION_PROTECTION_SCHEME_NONE);
+    if (scheme == MF_SAMPLE_ENCRYPTION_PROTECTION_SCHEME_NONE)
+    {
+        pSample->AddRef();
+        *ppSample = pSample;
+        return S_OK;
+    }
+    if (scheme != MF_SAMPLE_ENCRYPTION_PROTECTION_SCHEME_AES_CTR && scheme != MF_SAMPLE_ENCRYPTION_PROTECTION_SCHEME_AES_CBC)
+    {
+        return MF_E_UNSUPPORTED_FORMAT;
+    }
+
+    GUID keyId = GUID_NULL;
+    (void)pSample->GetGUID(MFSampleExtension_Encryption_KeyID, &keyId);
+    const AesCipher* cipher = FindCipher(keyId);
+    if (cipher == nullptr)
+    {
+        return NTE_NO_KEY;
+    }
+
+    // Payload that other samples can see is never written to.
+    winrt::com_ptr<IMFSample> target;
+    DWORD bufferCount = 0;
+    CHECK_HR(hr = pSample->GetBufferCount(&bufferCount));
+    if (bufferCount == 1 && !MFGetAttributeUINT32(pSample, SampleExtension_SharedPayload, FALSE))
+    {
+        target.copy_from(pSample);
+    }
+    else
+    {
+        CHECK_HR(hr = CopyToPool(pSample, pPool, target.put()));
+    }
+
+    winrt::com_ptr<IMFMediaBuffer> buffer;
+    BYTE* data = nullptr;
+    DWORD length = 0;
+    DWORD decrypted = 0;
+    CHECK_HR(hr = target->GetBufferByIndex(0, buffer.put()));
+    CHECK_HR(hr = buffer->Lock(&data, NULL, &length));
+    hr = DecryptPayload(pSample, scheme, *cipher, data, length, &decrypted);
+    (void)buffer->Unlock();
+    CHECK_HR(hr);
+
+    for (const GUID* attribute : s_encryptionAttributes)
+    {
+        (void)target->DeleteItem(*attribute);
+    }
+    InterlockedIncrement64(&m_samples);
+    InterlockedAdd64(&m_bytesDecrypted, decrypted);
+    *ppSample = target.detach();
+    return hr;
+}
+
+HRESULT CencDecryptor::CopyToPool(IMFSample* pSample, SamplePool* pPool, IMFSample** ppCopy)
+{
+    HRESULT hr = S_OK;
+    winrt::com_ptr<IMFSample> copy;
+    winrt::com_ptr<IMFMediaBuffer> buffer;
+    DWORD length = 0;
+    LONGLONG time = 0;
+    LONGLONG duration = 0;
+    CHECK_HR(hr = pSample->GetTotalLength(&length));
+    if (pPool != NULL && length <= pPool->BufferSize())
+    {
+        CHECK_HR(hr = pPool->AcquireSample(copy.put()));
+        CHECK_HR(hr = copy->GetBufferByIndex(0, buffer.put()));
+    }
+    else
+    {
+        CHECK_HR(hr = MFCreateSample(copy.put()));
+        CHECK_HR(hr = MFCreateMemoryBuffer(length, buffer.put()));
+        CHECK_HR(hr = copy->AddBuffer(buffer.get()));
+    }
+    CHECK_HR(hr = pSample->CopyToBuffer(buffer.get()));
+    CHECK_HR(hr = pSample->CopyAllItems(copy.get()));
+    (void)copy->DeleteItem(SampleExtension_SharedPayload);
+    if (SUCCEEDED(pSample->GetSampleTime(&time)))
+    {
+        CHECK_HR(hr = copy->SetSampleTime(time));
+    }
+    if (SUCCEEDED(pSample->GetSampleDuration(&duration)))
+    {
+        CHECK_HR(hr = copy->SetSampleDuration(duration));
+    }
+    InterlockedAdd64(&m_bytesCopied, length);
+    *ppCopy = copy.detach();
+    return hr;
+}
+
+// The subsample map is a list of (clear bytes, protected bytes) pairs; with
+// no map the whole sample is protected. 'cenc' runs one CTR keystream over
+// all protected bytes of the sample. 'cbcs' restarts the CBC chain from the
+// IV at each subsample and, with a pattern, decrypts crypt blocks out of
+// every crypt + skip; a partial last block stays clear.
+HRESULT CencDecryptor::DecryptPayload(IMFSample* pSample, UINT32 scheme, const AesCipher& cipher, BYTE* pData, DWORD length, DWORD* pDecrypted)
+{
+    HRESULT hr = S_OK;
+    BYTE iv[16] = {};
+    UINT32 ivSize = 0;
+    if (FAILED(pSample->GetBlobSize(MFSampleExtension_Encryption_SampleID, &ivSize)) || (ivSize != 8 && ivSize != 16))
+    {
+        return MF_E_INVALID_STREAM_DATA;
+    }
+    CHECK_HR(hr = pSample->GetBlob(MFSampleExtension_Encryption_SampleID, iv, sizeof(iv), NULL));
+
+    std::vector<DWORD> map;
+    UINT32 mapSize = 0;
+    if (SUCCEEDED(pSample->GetBlobSize(MFSampleExtension_Encryption_SubSample_Mapping, &mapSize)) && mapSize > 0)
+    {
+        if (mapSize % (2 * sizeof(DWORD)) != 0)
+        {
+            return MF_E_INVALID_STREAM_DATA;
+        }
+        map.resize(mapSize / sizeof(DWORD));
+        CHECK_HR(hr = pSample->GetBlob(MFSampleExtension_Encryption_SubSample_Mapping, (UINT8*)map.data(), mapSize, NULL));
+    }
+    else
+    {
+        map = { 0, length };
+    }
+
+    ULONGLONG total = 0;
+    for (DWORD size : map)
+    {
+        total += size;
+    }
+    if (total > length)
+    {
+        return MF_E_INVALID_STREAM_DATA;
+    }
+
+    UINT32 crypt = MFGetAttributeUINT32(pSample, MFSampleExtension_Encryption_CryptByteBlock, 0);
+    UINT32 skip = MFGetAttributeUINT32(pSample, MFSampleExtension_Encryption_SkipByteBlock, 0);
+    CtrState ctr;
+    memcpy(ctr.counter, iv, sizeof(iv));
+
+    DWORD position = 0;
+    DWORD decrypted = 0;
+    for (size_t i = 0; i < map.size(); i += 2)
+    {
+        position += map[i];
+        BYTE* protectedData = pData + position;
+        DWORD protectedLength = map[i + 1];
+        position += protectedLength;
+
+        if (scheme == MF_SAMPLE_ENCRYPTION_PROTECTION_SCHEME_AES_CTR && crypt == 0)
+        {
+            CtrRange(cipher, ctr, protectedData, protectedLength);
+            decrypted += protectedLength;
+            continue;
+        }
+
+        BYTE chain[16];
+        memcpy(chain, iv, sizeof(iv));
+        size_t blocks = protectedLength / AES_BLOCK_SIZE;
+        size_t stride = crypt == 0 ? blocks : (size_t)crypt + skip;
+        for (size_t block = 0; block < blocks; block += stride)
+        {
+            size_t run = crypt == 0 ? blocks : (std::min)((size_t)crypt, blocks - block);
+            BYTE* runData = protectedData + block * AES_BLOCK_SIZE;
+            if (scheme == MF_SAMPLE_ENCRYPTION_PROTECTION_SCHEME_AES_CTR)
+            {
+                CtrRange(cipher, ctr, runData, run * AES_BLOCK_SIZE);
+            }
+            else
+            {
+                cipher.CbcDecrypt(chain, runData, run);
+            }
+            decrypted += (DWORD)(run * AES_BLOCK_SIZE);
+        }
+    }
+    *pDecrypted = decrypted;
+    return hr;
+}
+
+void CencDecryptor::GetCounters(DecryptCounters* pCounters)
+{
+    pCounters->samples = m_samples;
+    pCounters->bytesDecrypted = m_bytesDecrypted;
+    pCounters->bytesCopied = m_bytesCopied;
+}
+
+struct DecryptQueue::Work
+{
+    winrt::com_ptr<DecryptQueue> queue;
+    std::shared_ptr<Job> job;
+};
+
+DecryptQueue::DecryptQueue(CencDecryptor* pDecryptor)
+{
+    InitializeCriticalSection(&m_critSec);
+    m_decryptor.copy_from(pDecryptor);
+}
+
+DecryptQueue::~DecryptQueue()
+{
+    DeleteCriticalSection(&m_critSec);
+}
+
+HRESULT DecryptQueue::Submit(IMFSample* pSample, SamplePool* pPool)
+{
+    if (pSample == NULL)
+    {
+        return E_POINTER;
+    }
+
+    auto job = std::make_shared<Job>();
+    job->sample.copy_from(pSample);
+    job->pool.copy_from(pPool);
+
+    // Clear samples only wait for the ones ahead of them.
+    bool encrypted = MFGetAttributeUINT32(pSample, MFSampleExtension_Encryption_ProtectionScheme,
+        MF_SAMPLE_ENCRYPTION_PROTECTION_SCHEME_NONE) != MF_SAMPLE_ENCRYPTION_PROTECTION_SCHEME_NONE;
+    if (!encrypted)
+    {
+        job->result = job->sample;
+        job->complete = true;
+    }
+
+    EnterCriticalSection(&m_critSec);
+    m_jobs.push_back(job);
+    LeaveCriticalSection(&m_critSec);
+    if (!encrypted)
+    {
+        return S_OK;
+    }
+
+    // The work item holds the queue, and with it the job, even if Cancel
+    // drops the job in the meantime.
+    Work* work = new (std::nothrow) Work();
+    if (work == nullptr)
+    {
+        RunJob(job);
+        return S_OK;
+    }
+    work->queue = get_strong();
+    work->job = job;
+    if (!TrySubmitThreadpoolCallback(OnWork, work, NULL))
+    {
+        delete work;
+        RunJob(job);
+    }
+    return S_OK;
+}
+
+VOID CALLBACK DecryptQueue::OnWork(PTP_CALLBACK_INSTANCE, PVOID pContext)
+{
+    Work* work = (Work*)pContext;
+    work->queue->RunJob(work->job);
+    delete work;
+}
+
+void DecryptQueue::RunJob(std::shared_ptr<Job> job)
+{
+    winrt::com_ptr<IMFSample> result;
+    HRESULT hr = m_decryptor->Decrypt(job->sample.get(), job->pool.get(), result.put());
+
+    DataReadyCallback callback;
+    EnterCriticalSection(&m_critSec);
+    job->result = result;
+    job->status = hr;
+    job->complete = true;
+    if (!m_jobs.empty() && m_jobs.front() == job)
+    {
+        callback = m_onDataReady;
+    }
+    LeaveCriticalSection(&m_critSec);
+
+    if (callback)
+    {
+        callback();
+    }
+}
+
+HRESULT DecryptQueue::GetCompleted(IMFSample** ppSample)
+{
+    if (ppSample == NULL)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+    EnterCriticalSection(&m_critSec);
+    if (m_jobs.empty())
+    {
+        hr = S_FALSE;
+    }
+    else if (!m_jobs.front()->complete)
+    {
+        hr = E_PENDING;
+    }
+    else
+    {
+        std::shared_ptr<Job> job = m_jobs.front();
+        m_jobs.pop_front();
+        hr = job->status;
+        if (SUCCEEDED(hr))
+        {
+            *ppSample = job->result.detach();
+        }
+    }
+    LeaveCriticalSection(&m_critSec);
+    return hr;
+}
+
+void DecryptQueue::SetDataReadyCallback(DataReadyCallback callback)
+{
+    EnterCriticalSection(&m_critSec);
+    m_onDataReady = callback;
+    LeaveCriticalSection(&m_critSec);
+}
+
+void DecryptQueue::Cancel()
+{
+    EnterCriticalSection(&m_critSec);
+    m_jobs.clear();
+    LeaveCriticalSection(&m_critSec);
+}
+
+size_t DecryptQueue::QueuedCount()
+{
+    EnterCriticalSection(&m_critSec);
+    size_t count = m_jobs.size();
+    LeaveCriticalSection(&m_critSec);
+    return count;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <mfapi.h>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "AesCipher.h"
+#include "SamplePool.h"
+#include "SampleProducer.h"
+
+struct DecryptCounters
+{
+    LONGLONG samples;           // Encrypted samples decrypted.
+    LONGLONG bytesDecrypted;    // Protected bytes; clear subsample bytes are not counted.
+    LONGLONG bytesCopied;       // Payload copied because it could not be decrypted in place.
+};
+
+// Clear-key decryption of Common Encryption samples: AES-CTR ('cenc') and
+// AES-CBC with a crypt/skip pattern ('cbcs'). The producer describes each
+// sample with the MFSampleExtension_Encryption_* attributes (scheme, key id,
+// IV, subsample map and pattern), which are removed once the payload is
+// clear. One decryptor holds the keys for any number of streams and can be
+// called from many threads at once.
+class CencDecryptor : public winrt::implements<CencDecryptor, IUnknown>
+{
+public:
+    CencDecryptor(bool useAesNi = CpuFeatures::HasAesNi());
+    ~CencDecryptor();
+
+    // Samples without a key id use the first key added.
+    HRESULT AddKey(const GUID& keyId, const BYTE key[16]);
+
+    // Decrypts in place when the sample has a single buffer of its own.
+    // Payload spread over several buffers, or shared with other samples, is
+    // first copied into a buffer from pPool and returned in a new sample.
+    // Samples without encryption attributes are returned as they are.
+    HRESULT Decrypt(IMFSample* pSample, SamplePool* pPool, IMFSample** ppSample);
+
+    bool UsesAesNi() const { return m_aesNi; }
+    void GetCounters(DecryptCounters* pCounters);
+
+private:
+    const AesCipher* FindCipher(const GUID& keyId);
+    HRESULT CopyToPool(IMFSample* pSample, SamplePool* pPool, IMFSample** ppCopy);
+    HRESULT DecryptPayload(IMFSample* pSample, UINT32 scheme, const AesCipher& cipher, BYTE* pData, DWORD length, DWORD* pDecrypted);
+
+    CRITICAL_SECTION m_critSec;
+    bool m_aesNi;
+    std::vector<std::pair<GUID, std::unique_ptr<AesCipher>>> m_keys;   // Never removed, so ciphers can be used unlocked.
+
+    volatile LONGLONG m_samples = 0;
+    volatile LONGLONG m_bytesDecrypted = 0;
+    volatile LONGLONG m_bytesCopied = 0;
+};
+
+// Decrypts one stream's samples on the thread pool, several at a time, and
+// hands them back in the order they were submitted. Streams that share a
+// decryptor each have their own queue, so they decrypt in parallel too.
+class DecryptQueue : public winrt::implements<DecryptQueue, IUnknown>
+{
+public:
+    DecryptQueue(CencDecryptor* pDecryptor);
+    ~DecryptQueue();
+
+    HRESULT Submit(IMFSample* pSample, SamplePool* pPool);
+
+    // Next sample in submission order. E_PENDING while it is still being
+    // decrypted, S_FALSE when nothing is queued; a sample that failed to
+    // decrypt returns its error.
+    HRESULT GetCompleted(IMFSample** ppSample);
+
+    // Called from a worker thread whenever GetCompleted has something new.
+    void SetDataReadyCallback(DataReadyCallback callback);
+
+    // Drop everything queued; decryptions still running finish unseen.
+    void Cancel();
+    size_t QueuedCount();
+
+private:
+    struct Job
+    {
+        winrt::com_ptr<IMFSample> sample;
+        winrt::com_ptr<SamplePool> pool;
+        winrt::com_ptr<IMFSample> result;
+        HRESULT status = S_OK;
+        bool complete = false;
+    };
+    struct Work;
+
+    static VOID CALLBACK OnWork(PTP_CALLBACK_INSTANCE, PVOID pContext);
+    void RunJob(std::shared_ptr<Job> job);
+
+    CRITICAL_SECTION m_critSec;
+    winrt::com_ptr<CencDecryptor> m_decryptor;
+    std::deque<std::shared_ptr<Job>> m_jobs;
+    DataReadyCallback m_onDataReady;
+};
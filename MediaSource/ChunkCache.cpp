@@ -0,0 +1,320 @@
+#include "pch.h"
+#include "ChunkCache.h"
+#include <algorithm>
+#include "SampleSlices.h"
+
+HRESULT ChunkCache::GetShared(ChunkCache** ppCache)
+{
+    if (ppCache == NULL)
+    {
+        return E_POINTER;
+    }
+
+    static winrt::com_ptr<ChunkCache> s_shared = winrt::make_self<ChunkCache>();
+    s_shared.copy_to(ppCache);
+    return S_OK;
+}
+
+ChunkCache::ChunkCache(SIZE_T capacity)
+    : m_capacity(capacity)
+{
+    InitializeCriticalSection(&m_critSec);
+}
+
+ChunkCache::~ChunkCache()
+{
+    DeleteCriticalSection(&m_critSec);
+}
+
+HRESULT ChunkCache::Get(const CacheKey& key, IUnknown** ppValue, CacheLoader loader, CacheCompletion completion)
+{
+    if (ppValue == NULL)
+    {
+        return E_POINTER;
+    }
+
+    EnterCriticalSection(&m_critSec);
+    m_counters.lookups++;
+    auto found = m_entries.find(key);
+    if (found != m_entries.end())
+    {
+        Entry& entry = found->second;
+        if (entry.loading)
+        {
+            m_counters.joins++;
+            entry.waiters.push_back(completion);
+            LeaveCriticalSection(&m_critSec);
+            return E_PENDING;
+        }
+
+        m_counters.hits++;
+        m_counters.bytesSaved += entry.size;
+        m_lru.splice(m_lru.begin(), m_lru, entry.lruPosition);
+        entry.value.copy_to(ppValue);
+        LeaveCriticalSection(&m_critSec);
+        return S_OK;
+    }
+
+    m_counters.loads++;
+    m_entries[key].waiters.push_back(completion);
+    LeaveCriticalSection(&m_critSec);
+
+    // Callers that miss while the loader runs join the entry's waiters.
+    auto self = get_strong();
+    HRESULT hr = loader([self, key](HRESULT hrLoad, IUnknown* pValue, SIZE_T size)
+        {
+            self->Fill(key, hrLoad, pValue, size);
+        });
+    if (FAILED(hr))
+    {
+        Fill(key, hr, nullptr, 0);
+    }
+    return E_PENDING;
+}
+
+void ChunkCache::Fill(const CacheKey& key, HRESULT hr, IUnknown* pValue, SIZE_T size)
+{
+    std::vector<CacheCompletion> waiters;
+    winrt::com_ptr<IUnknown> value;
+    value.copy_from(pValue);
+    if (SUCCEEDED(hr) && !value)
+    {
+        hr = E_UNEXPECTED;
+    }
+
+    EnterCriticalSection(&m_critSec);
+    auto found = m_entries.find(key);
+    if (found != m_entries.end())
+    {
+        Entry& entry = found->second;
+        waiters.swap(entry.waiters);
+        if (FAILED(hr))
+        {
+            m_entries.erase(found);
+        }
+        else
+        {
+            entry.value = value;
+            entry.size = size;
+            entry.loading = false;
+            m_lru.push_front(key);
+            entry.lruPosition = m_lru.begin();
+            m_counters.bytesLoaded += size;
+            m_counters.bytesSaved += size * (waiters.size() - 1);
+            m_counters.residentBytes += size;
+            EvictToCapacity();
+        }
+    }
+    LeaveCriticalSection(&m_critSec);
+
+    // Waiters get the value even if it was evicted again straight away.
+    for (auto& waiter : waiters)
+    {
+        waiter(hr, value.get());
+    }
+}
+
+void ChunkCache::Invalidate(const std::wstring& asset)
+{
+    EnterCriticalSection(&m_critSec);
+    for (auto position = m_lru.begin(); position != m_lru.end();)
+    {
+        if (position->asset == asset)
+        {
+            auto found = m_entries.find(*position);
+            m_counters.residentBytes -= found->second.size;
+            m_entries.erase(found);
+            position = m_lru.erase(position);
+        }
+        else
+        {
+            ++position;
+        }
+    }
+    LeaveCriticalSection(&m_critSec);
+}
+
+void ChunkCache::SetCapacity(SIZE_T capacity)
+{
+    EnterCriticalSection(&m_critSec);
+    m_capacity = capacity;
+    EvictToCapacity();
+    LeaveCriticalSection(&m_critSec);
+}
+
+void ChunkCache::GetCounters(ChunkCacheCounters* pCounters)
+{
+    EnterCriticalSection(&m_critSec);
+    *pCounters = m_counters;
+    LeaveCriticalSection(&m_critSec);
+}
+
+// Called with m_critSec held. Entries still loading are not in m_lru.
+void ChunkCache::EvictToCapacity()
+{
+    while ((SIZE_T)m_counters.residentBytes > m_capacity && !m_lru.empty())
+    {
+        auto found = m_entries.find(m_lru.back());
+        m_counters.evictions++;
+        m_counters.bytesEvicted += found->second.size;
+        m_counters.residentBytes -= found->second.size;
+        m_entries.erase(found);
+        m_lru.pop_back();
+    }
+}
+
+struct CachedAsset::RangeRead
+{
+    ULONGLONG offset = 0;
+    DWORD length = 0;
+    ULONGLONG firstChunk = 0;
+    DWORD chunkSize = 0;
+    std::vector<winrt::com_ptr<IUnknown>> chunks;
+    volatile LONG remaining = 0;
+    volatile HRESULT status = S_OK;
+    RangeCompletion completion;
+};
+
+CachedAsset::CachedAsset(ChunkCache* pCache, AsyncFile* pFile, LPCWSTR assetId, DWORD chunkSize)
+    : m_assetId(assetId), m_chunkSize(chunkSize > 0 ? chunkSize : DEFAULT_CACHE_CHUNK_SIZE)
+{
+    m_cache.copy_from(pCache);
+    m_file.copy_from(pFile);
+}
+
+HRESULT CachedAsset::ReadRange(ULONGLONG offset, DWORD length, IMFSample** ppSample, RangeCompletion completion)
+{
+    if (ppSample == NULL)
+    {
+        return E_POINTER;
+    }
+    if (length == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    ULONGLONG first = offset / m_chunkSize;
+    ULONGLONG last = (offset + length - 1) / m_chunkSize;
+    auto read = std::make_shared<RangeRead>();
+    read->offset = offset;
+    read->length = length;
+    read->firstChunk = first * m_chunkSize;
+    read->chunkSize = m_chunkSize;
+    read->chunks.resize((size_t)(last - first + 1));
+    read->completion = completion;
+
+    // One count per chunk plus one for this call, so the sample is built
+    // exactly once: here if every chunk was resident, otherwise by the last
+    // load to finish.
+    read->remaining = (LONG)read->chunks.size() + 1;
+    auto self = get_strong();
+    for (size_t i = 0; i < read->chunks.size(); i++)
+    {
+        ULONGLONG chunkOffset = read->firstChunk + (ULONGLONG)i * m_chunkSize;
+        CacheKey key = { m_assetId, chunkOffset, CacheKind::CHUNK };
+        winrt::com_ptr<IUnknown> chunk;
+        HRESULT hr = m_cache->Get(key, chunk.put(),
+            [self, chunkOffset](CacheFill fill)
+            {
+                return self->LoadChunk(chunkOffset, fill);
+            },
+            [read, i](HRESULT hrLoad, IUnknown* pValue)
+            {
+                OnChunk(read, i, hrLoad, pValue);
+            });
+        if (hr != E_PENDING)
+        {
+            OnChunk(read, i, hr, chunk.get());
+        }
+    }
+
+    if (InterlockedDecrement(&read->remaining) == 0)
+    {
+        return BuildSample(*read, ppSample);
+    }
+    return E_PENDING;
+}
+
+HRESULT CachedAsset::LoadChunk(ULONGLONG chunkOffset, CacheFill fill)
+{
+    HRESULT hr = S_OK;
+    winrt::com_ptr<MemorySlab> slab;
+    CHECK_HR(hr = MemorySlab::Create(m_chunkSize, NUMA_NO_PREFERRED_NODE, slab.put()));
+
+    // The completion holds the slab the read is writing into. A short read
+    // is the end of the asset; the chunk keeps what was read.
+    DWORD chunkSize = m_chunkSize;
+    return m_file->ReadAt(chunkOffset, slab->Data(), chunkSize,
+        [slab, chunkSize, fill](HRESULT hrRead, DWORD bytesRead)
+        {
+            HRESULT hr = hrRead;
+            winrt::com_ptr<IMFMediaBuffer> buffer;
+            if (SUCCEEDED(hr) && bytesRead == 0)
+            {
+                hr = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+            }
+            if (SUCCEEDED(hr))
+            {
+                hr = SliceBuffer::Create(slab.get(), slab->Data(), chunkSize, bytesRead, buffer.put());
+            }
+            fill(hr, buffer.get(), chunkSize);
+        });
+}
+
+void CachedAsset::OnChunk(std::shared_ptr<RangeRead> read, size_t index, HRESULT hr, IUnknown* pValue)
+{
+    if (FAILED(hr))
+    {
+        InterlockedCompareExchange((volatile LONG*)&read->status, hr, S_OK);
+    }
+    else
+    {
+        read->chunks[index].copy_from(pValue);
+    }
+
+    if (InterlockedDecrement(&read->remaining) == 0)
+    {
+        winrt::com_ptr<IMFSample> sample;
+        HRESULT hrBuild = BuildSample(*read, sample.put());
+        read->completion(hrBuild, sample.get());
+    }
+}
+
+HRESULT CachedAsset::BuildSample(RangeRead& read, IMFSample** ppSample)
+{
+    HRESULT hr = read.status;
+    CHECK_HR(hr);
+
+    winrt::com_ptr<IMFSample> sample;
+    CHECK_HR(hr = MFCreateSample(sample.put()));
+    ULONGLONG position = read.offset;
+    DWORD remaining = read.length;
+    for (size_t i = 0; i < read.chunks.size() && remaining > 0; i++)
+    {
+        auto buffer = read.chunks[i].try_as<IMFMediaBuffer>();
+        if (!buffer)
+        {
+            return E_UNEXPECTED;
+        }
+
+        DWORD chunkLength = 0;
+        CHECK_HR(hr = buffer->GetCurrentLength(&chunkLength));
+        DWORD start = (DWORD)(position - (read.firstChunk + (ULONGLONG)i * read.chunkSize));
+        if (start >= chunkLength)
+        {
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+        }
+        DWORD length = (std::min)(remaining, chunkLength - start);
+        CHECK_HR(hr = SampleSlices::AddBufferSlice(sample.get(), buffer.get(), start, length));
+        position += length;
+        remaining -= length;
+    }
+    if (remaining > 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+    }
+
+    CHECK_HR(hr = sample->SetUINT32(SampleExtension_SharedPayload, TRUE));
+    *ppSample = sample.detach();
+    return hr;
+}
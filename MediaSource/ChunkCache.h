@@ -0,0 +1,136 @@
+#pragma once
+#include <mfapi.h>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "AsyncFile.h"
+#include "MemoryBuffer.h"
+
+enum class CacheKind
+{
+    CHUNK,          // Aligned byte range of an asset, as an IMFMediaBuffer.
+    SAMPLE_TABLE    // Producer-defined parsed index, keyed by where it lies in the asset.
+};
+
+struct CacheKey
+{
+    std::wstring asset;
+    ULONGLONG offset;
+    CacheKind kind;
+
+    bool operator==(const CacheKey& other) const
+    {
+        return offset == other.offset && kind == other.kind && asset == other.asset;
+    }
+};
+
+struct CacheKeyHash
+{
+    size_t operator()(const CacheKey& key) const
+    {
+        return std::hash<std::wstring>()(key.asset) ^ (std::hash<ULONGLONG>()(key.offset) * 31 + (size_t)key.kind);
+    }
+};
+
+const SIZE_T DEFAULT_CACHE_CAPACITY = 256 << 20;
+const DWORD DEFAULT_CACHE_CHUNK_SIZE = 1 << 20;
+
+struct ChunkCacheCounters
+{
+    LONGLONG lookups;
+    LONGLONG hits;              // Served from a resident entry.
+    LONGLONG joins;             // Waited on a load another caller had started.
+    LONGLONG loads;             // Misses that ran a loader.
+    LONGLONG bytesLoaded;
+    LONGLONG bytesSaved;        // Handed out by hits and joins instead of being loaded again.
+    LONGLONG evictions;
+    LONGLONG bytesEvicted;
+    LONGLONG residentBytes;
+};
+
+// Reports the outcome of a load: the value and the bytes it accounts for.
+typedef std::function<void(HRESULT hr, IUnknown* pValue, SIZE_T size)> CacheFill;
+// Starts a load that calls fill exactly once, on any thread, or returns the
+// error it failed to start with instead.
+typedef std::function<HRESULT(CacheFill fill)> CacheLoader;
+// Called with the value once a pending Get completes.
+typedef std::function<void(HRESULT hr, IUnknown* pValue)> CacheCompletion;
+
+// Process-wide, size-bounded LRU cache of whatever sources would otherwise
+// load once each: chunks of an asset's bytes and the sample tables parsed
+// from them. Values are COM objects handed out by reference, so samples can
+// slice a cached chunk without copying, and an entry evicted while in use
+// stays valid for its holders; only resident entries count against the
+// capacity. Concurrent misses on one key run a single load that every
+// caller waits on. Failed loads are not cached.
+class ChunkCache : public winrt::implements<ChunkCache, IUnknown>
+{
+public:
+    // The instance shared by every source in the process.
+    static HRESULT GetShared(ChunkCache** ppCache);
+
+    ChunkCache(SIZE_T capacity = DEFAULT_CACHE_CAPACITY);
+    ~ChunkCache();
+
+    // S_OK with the resident value in *ppValue. Otherwise E_PENDING: the
+    // value is loaded with loader, unless a load is already running, and
+    // completion runs exactly once when it is done.
+    HRESULT Get(const CacheKey& key, IUnknown** ppValue, CacheLoader loader, CacheCompletion completion);
+
+    // Drop every resident entry of an asset, e.g. when it changes on disk.
+    void Invalidate(const std::wstring& asset);
+    void SetCapacity(SIZE_T capacity);
+    void GetCounters(ChunkCacheCounters* pCounters);
+
+private:
+    struct Entry
+    {
+        winrt::com_ptr<IUnknown> value;
+        SIZE_T size = 0;
+        bool loading = true;
+        std::vector<CacheCompletion> waiters;
+        std::list<CacheKey>::iterator lruPosition;     // Valid once loaded.
+    };
+
+    void Fill(const CacheKey& key, HRESULT hr, IUnknown* pValue, SIZE_T size);
+    void EvictToCapacity();
+
+    CRITICAL_SECTION m_critSec;
+    SIZE_T m_capacity;
+    std::unordered_map<CacheKey, Entry, CacheKeyHash> m_entries;
+    std::list<CacheKey> m_lru;      // Loaded entries, most recently used first.
+    ChunkCacheCounters m_counters = {};
+};
+
+// Called once a pending ReadRange has built its sample.
+typedef std::function<void(HRESULT hr, IMFSample* pSample)> RangeCompletion;
+
+// One source's view of an asset read through a ChunkCache in aligned
+// chunks. Sources that open the same asset id share its chunks.
+class CachedAsset : public winrt::implements<CachedAsset, IUnknown>
+{
+public:
+    CachedAsset(ChunkCache* pCache, AsyncFile* pFile, LPCWSTR assetId, DWORD chunkSize = DEFAULT_CACHE_CHUNK_SIZE);
+
+    // A sample whose buffers slice the cached chunks covering the range. S_OK
+    // if they are all resident, otherwise E_PENDING and completion runs once
+    // they are loaded.
+    HRESULT ReadRange(ULONGLONG offset, DWORD length, IMFSample** ppSample, RangeCompletion completion);
+
+    const std::wstring& AssetId() const { return m_assetId; }
+
+private:
+    struct RangeRead;
+
+    HRESULT LoadChunk(ULONGLONG chunkOffset, CacheFill fill);
+    static void OnChunk(std::shared_ptr<RangeRead> read, size_t index, HRESULT hr, IUnknown* pValue);
+    static HRESULT BuildSample(RangeRead& read, IMFSample** ppSample);
+
+    winrt::com_ptr<ChunkCache> m_cache;
+    winrt::com_ptr<AsyncFile> m_file;
+    std::wstring m_assetId;
+    DWORD m_chunkSize;
+};
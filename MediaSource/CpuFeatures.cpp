@@ -0,0 +1,41 @@
+#include "pch.h"
+#include "CpuFeatures.h"
+#include <intrin.h>
+#include <immintrin.h>
+
+static SimdLevel DetectSimdLevel()
+{
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+
+    // AVX2 also needs the OS to save YMM state.
+    if (osxsave && avx && (_xgetbv(0) & 6) == 6)
+    {
+        __cpuidex(info, 7, 0);
+        if ((info[1] & (1 << 5)) != 0)
+        {
+            return SimdLevel::AVX2;
+        }
+    }
+    return sse2 ? SimdLevel::SSE2 : SimdLevel::SCALAR;
+}
+
+SimdLevel CpuFeatures::GetSimdLevel()
+{
+    static const SimdLevel level = DetectSimdLevel();
+    return level;
+}
+
+bool CpuFeatures::HasAesNi()
+{
+    static const bool aesNi = []()
+    {
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 25)) != 0;
+    }();
+    return aesNi;
+}
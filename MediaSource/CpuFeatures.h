@@ -0,0 +1,19 @@
+#pragma once
+#include <windows.h>
+
+// Widest vector instruction set usable on this machine.
+enum class SimdLevel
+{
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+// CPUID checks, done once and cached. Kernels with several implementations
+// pick one from here at startup.
+class CpuFeatures
+{
+public:
+    static SimdLevel GetSimdLevel();
+    static bool HasAesNi();
+};
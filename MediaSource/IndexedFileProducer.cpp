@@ -0,0 +1,124 @@
+#include "pch.h"
+#include "IndexedFileProducer.h"
+#include <Mferror.h>
+#include <algorithm>
+
+// Samples kept enqueued on the reader ahead of demand.
+const size_t INDEXED_READ_AHEAD = 32;
+
+IndexedFileProducer::IndexedFileProducer(AsyncFile* pFile, IMFMediaType* pType, const std::vector<IndexEntry>& index,
+    DWORD readSize, DWORD maxInFlight)
+    : m_index(index)
+{
+    InitializeCriticalSection(&m_critSec);
+    m_type.copy_from(pType);
+    for (const IndexEntry& entry : m_index)
+    {
+        m_maxSampleSize = (std::max)(m_maxSampleSize, entry.length);
+    }
+
+    // Every sample has to fit in one read.
+    auto pool = winrt::make_self<SamplePool>((std::max)(readSize, m_maxSampleSize));
+    m_reader = winrt::make_self<StreamReader>(pFile, pool.get(), maxInFlight);
+}
+
+IndexedFileProducer::~IndexedFileProducer()
+{
+    DeleteCriticalSection(&m_critSec);
+}
+
+HRESULT IndexedFileProducer::GetMediaType(DWORD /*streamIndex*/, IMFMediaType** ppType)
+{
+    if (ppType == NULL)
+    {
+        return E_POINTER;
+    }
+    m_type.copy_to(ppType);
+    return S_OK;
+}
+
+DWORD IndexedFileProducer::GetMaxSampleSize(DWORD /*streamIndex*/)
+{
+    return m_maxSampleSize;
+}
+
+HRESULT IndexedFileProducer::ReadSample(DWORD /*streamIndex*/, SamplePool* /*pPool*/, IMFSample** ppSample)
+{
+    if (ppSample == NULL)
+    {
+        return E_POINTER;
+    }
+
+    // Samples slice the reader's buffers rather than the stream's pool.
+    HRESULT hr = S_OK;
+    EnterCriticalSection(&m_critSec);
+    hr = EnqueueAhead();
+    if (SUCCEEDED(hr))
+    {
+        hr = m_reader->GetCompleted(ppSample);
+        if (hr == S_OK)
+        {
+            m_enqueued.pop_front();
+        }
+        else if (hr == S_FALSE)
+        {
+            hr = MF_E_END_OF_STREAM;
+        }
+    }
+    LeaveCriticalSection(&m_critSec);
+    return hr;
+}
+
+// The reader calls the stream back directly whenever it completes a read.
+void IndexedFileProducer::SetDataReadyCallback(DWORD /*streamIndex*/, DataReadyCallback callback)
+{
+    m_reader->SetDataReadyCallback(callback);
+}
+
+HRESULT IndexedFileProducer::Shutdown()
+{
+    m_reader->SetDataReadyCallback(nullptr);
+    m_reader->Cancel();
+
+    EnterCriticalSection(&m_critSec);
+    m_enqueued.clear();
+    m_next = m_index.size();
+    LeaveCriticalSection(&m_critSec);
+    return S_OK;
+}
+
+HRESULT IndexedFileProducer::SetRate(DWORD /*streamIndex*/, float /*rate*/, bool thin)
+{
+    EnterCriticalSection(&m_critSec);
+    if (thin != m_thin)
+    {
+        // Whatever is already enqueued was picked for the old mode. Drop it
+        // and pick again from the first sample not yet handed out.
+        m_thin = thin;
+        m_reader->Cancel();
+        if (!m_enqueued.empty())
+        {
+            m_next = m_enqueued.front();
+            m_enqueued.clear();
+        }
+    }
+    LeaveCriticalSection(&m_critSec);
+    return S_OK;
+}
+
+// Called with m_critSec held.
+HRESULT IndexedFileProducer::EnqueueAhead()
+{
+    HRESULT hr = S_OK;
+    while (m_enqueued.size() < INDEXED_READ_AHEAD && m_next < m_index.size())
+    {
+        const IndexEntry& entry = m_index[m_next];
+        if (!m_thin || entry.cleanPoint)
+        {
+            CHECK_HR(hr = m_reader->Enqueue(entry.offset, entry.length, entry.time, entry.duration, entry.cleanPoint));
+            m_enqueued.push_back(m_next);
+        }
+        m_next++;
+    }
+    return hr;
+}
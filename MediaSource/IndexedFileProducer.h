@@ -0,0 +1,53 @@
+#pragma once
+#include <deque>
+#include <vector>
+#include "SampleProducer.h"
+#include "StreamReader.h"
+
+// Where one sample lies in the file, in decode order.
+struct IndexEntry
+{
+    ULONGLONG offset;
+    DWORD length;
+    LONGLONG time;
+    LONGLONG duration;
+    bool cleanPoint;
+};
+
+const DWORD INDEXED_READ_SIZE = 256 << 10;
+const DWORD INDEXED_MAX_IN_FLIGHT = 4;
+
+// Single-stream producer that plays a file through a StreamReader from a
+// sample index, e.g. one parsed from a container's sample table. Samples are
+// read ahead of demand. While the stream is thinned only the sync samples in
+// the index are read, so fast playback costs the bytes of its keyframes
+// rather than the whole stream.
+class IndexedFileProducer : public SampleProducer
+{
+public:
+    IndexedFileProducer(AsyncFile* pFile, IMFMediaType* pType, const std::vector<IndexEntry>& index,
+        DWORD readSize = INDEXED_READ_SIZE, DWORD maxInFlight = INDEXED_MAX_IN_FLIGHT);
+    ~IndexedFileProducer();
+
+    // SampleProducer
+    DWORD GetStreamCount() { return 1; }
+    HRESULT GetMediaType(DWORD streamIndex, IMFMediaType** ppType);
+    DWORD GetMaxSampleSize(DWORD streamIndex);
+    HRESULT ReadSample(DWORD streamIndex, SamplePool* pPool, IMFSample** ppSample);
+    void SetDataReadyCallback(DWORD streamIndex, DataReadyCallback callback);
+    HRESULT Shutdown();
+    HRESULT SetRate(DWORD streamIndex, float rate, bool thin);
+
+private:
+    HRESULT EnqueueAhead();
+
+    CRITICAL_SECTION m_critSec;
+    winrt::com_ptr<IMFMediaType> m_type;
+    winrt::com_ptr<StreamReader> m_reader;
+    std::vector<IndexEntry> m_index;
+    DWORD m_maxSampleSize = 0;
+
+    size_t m_next = 0;                  // Next index entry to enqueue.
+    std::deque<size_t> m_enqueued;      // Entries enqueued and not yet handed out, in order.
+    bool m_thin = false;
+};
@@ -4,40 +4,67 @@
 #pragma region IMFMediaEventGenerator
 HRESULT MediaSource::GetEvent(DWORD dwFlags, IMFMediaEvent** ppEvent)
 {
-    HRESULT hr = m_eventQueue->GetEvent(dwFlags, ppEvent);
+    HRESULT hr = S_OK;
+    CHECK_HR(hr = EnsureEventQueue());
+    hr = m_eventQueue->GetEvent(dwFlags, ppEvent);
     return hr;
 }
 
 HRESULT MediaSource::BeginGetEvent(IMFAsyncCallback* pCallback, IUnknown* punkState)
 {
-    HRESULT hr = m_eventQueue->BeginGetEvent(pCallback, punkState);
+    HRESULT hr = S_OK;
+    CHECK_HR(hr = EnsureEventQueue());
+    hr = m_eventQueue->BeginGetEvent(pCallback, punkState);
     return hr;
 }
 
 HRESULT MediaSource::EndGetEvent(IMFAsyncResult* pResult, IMFMediaEvent** ppEvent)
 {
-    HRESULT hr = m_eventQueue->EndGetEvent(pResult, ppEvent);
+    HRESULT hr = S_OK;
+    CHECK_HR(hr = EnsureEventQueue());
+    hr = m_eventQueue->EndGetEvent(pResult, ppEvent);
     return hr;
 }
 
 HRESULT MediaSource::QueueEvent(MediaEventType met, REFGUID guidExtendedType, HRESULT hrStatus, const PROPVARIANT* pvValue)
 {
-    HRESULT hr = m_eventQueue->QueueEventParamVar(met, guidExtendedType, hrStatus, pvValue);
+    HRESULT hr = S_OK;
+    CHECK_HR(hr = EnsureEventQueue());
+    hr = m_eventQueue->QueueEventParamVar(met, guidExtendedType, hrStatus, pvValue);
     return hr;
 }
+
+// Idle sources never create an event queue; it is built on first use.
+HRESULT MediaSource::EnsureEventQueue()
+{
+    AutoLock lock(m_lock->Get());
+    if (m_state == SourceState::STATE_SHUTDOWN)
+    {
+        return MF_E_SHUTDOWN;
+    }
+    if (m_eventQueue == nullptr)
+    {
+        return MFCreateEventQueue(m_eventQueue.put());
+    }
+    return S_OK;
+}
 #pragma endregion
 
 #pragma region IMFMediaSource
 HRESULT MediaSource::GetCharacteristics(DWORD* pdwCharacteristics)
 {
-    EnterCriticalSection(&m_critSec);
+    AutoLock lock(m_lock->Get());
     if (pdwCharacteristics == nullptr)
     {
         return E_POINTER;
     }
     HRESULT hr = S_OK;
     *pdwCharacteristics = MFMEDIASOURCE_CAN_PAUSE | MFMEDIASOURCE_IS_LIVE;
-    EnterCriticalSection(&m_critSec);
+    if (m_timeShift)
+    {
+        // Only within the time-shift window.
+        *pdwCharacteristics |= MFMEDIASOURCE_CAN_SEEK;
+    }
     return hr;
 }
 
@@ -45,14 +72,16 @@ HRESULT MediaSource::CreatePresentationDescriptor(IMFPresentationDescriptor** pp
 {
     HRESULT hr = S_OK;
 
+    // The presentation descriptor takes its own references.
+    std::vector<winrt::com_ptr<IMFStreamDescriptor>> descriptors{};
     std::vector<IMFStreamDescriptor*> streamDescriptors{};
     for (size_t i = 0; i < m_streams.size(); i++)
     {
         auto stream = m_streams[i];
         winrt::com_ptr<IMFStreamDescriptor> desc;
-        hr = stream->GetStreamDescriptor(desc.put());
+        CHECK_HR(hr = stream->GetStreamDescriptor(desc.put()));
         streamDescriptors.push_back(desc.get());
-        desc.detach();
+        descriptors.push_back(desc);
     }
 
     winrt::com_ptr<IMFPresentationDescriptor> presentationDescriptor;
@@ -67,13 +96,14 @@ HRESULT MediaSource::CreatePresentationDescriptor(IMFPresentationDescriptor** pp
 
     hr = presentationDescriptor->Clone(m_presentationDescriptor.put());
     *ppPresentationDescriptor = presentationDescriptor.detach();
+    MarkStartupPhase(StartupPhase::PD_BUILT);
 
     return hr;
 }
 
 HRESULT MediaSource::Start(IMFPresentationDescriptor* pPresentationDescriptor, const GUID* pguidTimeFormat, const PROPVARIANT* pvarStartPosition)
 {
-    EnterCriticalSection(&m_critSec);
+    AutoLock lock(m_lock->Get());
     HRESULT hr = S_OK;
     winrt::com_ptr<SourceOp> pAsyncOp = NULL;
 
@@ -99,16 +129,19 @@ HRESULT MediaSource::Start(IMFPresentationDescriptor* pPresentationDescriptor, c
     }
 
     // Check if this is a seek request. 
-    // Currently, this sample does not support seeking.
+    // Seeking is only supported inside the time-shift window.
 
-    if (pvarStartPosition->vt == VT_I8)
+    if (pvarStartPosition->vt == VT_I8 && !CanTimeShiftTo(pvarStartPosition->hVal.QuadPart))
     {
         // If the current state is STOPPED, then position 0 is valid.
 
         // If the current state is anything else, then the 
         // start position must be VT_EMPTY (current position).
 
-        if ((m_state != SourceState::STATE_STOPPED) || (pvarStartPosition->hVal.QuadPart != 0))
+        // A source that is still opening counts as stopped; the start op is
+        // queued behind OP_OPEN.
+        bool stopped = m_state == SourceState::STATE_STOPPED || m_state == SourceState::STATE_OPENING;
+        if (!stopped || (pvarStartPosition->hVal.QuadPart != 0))
         {
             return MF_E_INVALIDREQUEST;
         }
@@ -119,13 +152,152 @@ HRESULT MediaSource::Start(IMFPresentationDescriptor* pPresentationDescriptor, c
     // Create the state object for the async operation. 
     hr = SourceOp::CreateStartOp(pPresentationDescriptor, pAsyncOp.put());
     hr = pAsyncOp->SetData(*pvarStartPosition);
-    hr = m_operationQueue->QueueOperation(pAsyncOp.get());
+    hr = QueueOperation(pAsyncOp.get());
     return hr;
 }
 
 HRESULT MediaSource::Stop(void) { return S_OK; }
 HRESULT MediaSource::Pause(void) { return S_OK; }
-HRESULT MediaSource::Shutdown(void) { return S_OK; }
+
+HRESULT MediaSource::Shutdown(void)
+{
+    AutoLock lock(m_lock->Get());
+    if (m_state == SourceState::STATE_SHUTDOWN)
+    {
+        return MF_E_SHUTDOWN;
+    }
+
+    // Detach the streams first; a stream the pipeline still holds keeps the
+    // shared lock alive but no longer points back at this source.
+    for (size_t i = 0; i < m_streams.size(); i++)
+    {
+        (void)m_streams[i]->Shutdown();
+    }
+    m_streams.clear();
+
+    m_operationQueue->Shutdown();
+    if (m_eventQueue != nullptr)
+    {
+        (void)m_eventQueue->Shutdown();
+        m_eventQueue = nullptr;
+    }
+    m_presentationDescriptor = nullptr;
+    m_currentOp = nullptr;
+    if (m_producer != nullptr)
+    {
+        (void)m_producer->Shutdown();
+        m_producer = nullptr;
+    }
+    m_state = SourceState::STATE_SHUTDOWN;
+    return S_OK;
+}
+#pragma endregion
+
+#pragma region IMFGetService
+HRESULT MediaSource::GetService(REFGUID guidService, REFIID riid, LPVOID* ppvObject)
+{
+    if (ppvObject == NULL)
+    {
+        return E_POINTER;
+    }
+    *ppvObject = NULL;
+    if (guidService != MF_RATE_CONTROL_SERVICE && guidService != MF_RATE_SUPPORT_SERVICE)
+    {
+        return MF_E_UNSUPPORTED_SERVICE;
+    }
+    if (riid != __uuidof(IMFRateControl) && riid != __uuidof(IMFRateSupport))
+    {
+        return E_NOINTERFACE;
+    }
+    return QueryInterface(riid, ppvObject);
+}
+#pragma endregion
+
+#pragma region IMFRateControl
+HRESULT MediaSource::SetRate(BOOL fThin, float flRate)
+{
+    AutoLock lock(m_lock->Get());
+    HRESULT hr = S_OK;
+    winrt::com_ptr<SourceOp> pAsyncOp;
+
+    if (m_state == SourceState::STATE_SHUTDOWN)
+    {
+        return MF_E_SHUTDOWN;
+    }
+    CHECK_HR(hr = IsRateSupported(fThin, flRate, NULL));
+
+    CHECK_HR(hr = SourceOp::CreateSetRateOp(fThin, flRate, pAsyncOp.put()));
+    hr = QueueOperation(pAsyncOp.get());
+    return hr;
+}
+
+HRESULT MediaSource::GetRate(BOOL* pfThin, float* pflRate)
+{
+    if (pflRate == NULL)
+    {
+        return E_POINTER;
+    }
+    AutoLock lock(m_lock->Get());
+    if (pfThin != NULL)
+    {
+        *pfThin = m_thin;
+    }
+    *pflRate = m_rate;
+    return S_OK;
+}
+#pragma endregion
+
+#pragma region IMFRateSupport
+HRESULT MediaSource::GetSlowestRate(MFRATE_DIRECTION eDirection, BOOL /*fThin*/, float* pflRate)
+{
+    if (pflRate == NULL)
+    {
+        return E_POINTER;
+    }
+    if (eDirection == MFRATE_REVERSE)
+    {
+        return MF_E_REVERSE_UNSUPPORTED;
+    }
+    *pflRate = 0.0f;
+    return S_OK;
+}
+
+// Unthinned rates above THINNING_THRESHOLD_RATE are accepted too; the source
+// thins them itself.
+HRESULT MediaSource::GetFastestRate(MFRATE_DIRECTION eDirection, BOOL /*fThin*/, float* pflRate)
+{
+    if (pflRate == NULL)
+    {
+        return E_POINTER;
+    }
+    if (eDirection == MFRATE_REVERSE)
+    {
+        return MF_E_REVERSE_UNSUPPORTED;
+    }
+    *pflRate = MAX_THINNED_RATE;
+    return S_OK;
+}
+
+HRESULT MediaSource::IsRateSupported(BOOL /*fThin*/, float flRate, float* pflNearestSupportedRate)
+{
+    HRESULT hr = S_OK;
+    float nearest = flRate;
+    if (flRate < 0.0f)
+    {
+        hr = MF_E_REVERSE_UNSUPPORTED;
+        nearest = 0.0f;
+    }
+    else if (flRate > MAX_THINNED_RATE)
+    {
+        hr = MF_E_UNSUPPORTED_RATE;
+        nearest = MAX_THINNED_RATE;
+    }
+    if (pflNearestSupportedRate != NULL)
+    {
+        *pflNearestSupportedRate = nearest;
+    }
+    return hr;
+}
 #pragma endregion
 
 #pragma region Operation Queue
@@ -140,12 +312,13 @@ HRESULT MediaSource::ValidateOperation(SourceOp* /*pOp*/)
 
 HRESULT MediaSource::DispatchOperation(SourceOp* pOp)
 {
-    EnterCriticalSection(&m_critSec);
+    AutoLock lock(m_lock->Get());
     HRESULT hr = S_OK;
     if (m_state == SourceState::STATE_SHUTDOWN)
     {
         return S_OK; // Already shut down, ignore the request.
     }
+    OpTrace::Record(TraceEvent::OP_DISPATCH, m_sourceId, 0, (uint8_t)pOp->Op(), pOp->EnqueueTime());
     switch (pOp->Op())
     {
     case Operation::OP_START:
@@ -156,9 +329,19 @@ HRESULT MediaSource::DispatchOperation(SourceOp* pOp)
     case Operation::OP_PAUSE:
         break;
     case Operation::OP_REQUEST_DATA:
+        hr = DoRequestData();
         break;
     case Operation::OP_END_OF_STREAM:
         break;
+    case Operation::OP_OPEN:
+        hr = DoOpen();
+        break;
+    case Operation::OP_SET_RATE:
+        hr = DoSetRate((SetRateOp*)pOp);
+        break;
+    case Operation::OP_SET_PLACEMENT:
+        hr = DoSetPlacement();
+        break;
     default:
         hr = E_UNEXPECTED;
     }
@@ -170,11 +353,54 @@ HRESULT MediaSource::QueueAsyncOperation(Operation OpType)
     HRESULT hr = S_OK;
     winrt::com_ptr<SourceOp> pOp;
     hr = SourceOp::CreateOp(OpType, pOp.put());
-    hr = m_operationQueue->QueueOperation(pOp.get());
+    hr = QueueOperation(pOp.get());
     return hr;
 }
+
+HRESULT MediaSource::QueueOperation(SourceOp* pOp)
+{
+    if (OpTrace::IsRecording())
+    {
+        pOp->SetEnqueueTime(OpTrace::Now());
+        OpTrace::Record(TraceEvent::OP_ENQUEUE, m_sourceId, 0, (uint8_t)pOp->Op(), TraceArguments(pOp));
+    }
+    return m_operationQueue->QueueOperation(pOp);
+}
+
+// What replay needs to issue the op again.
+LONGLONG MediaSource::TraceArguments(SourceOp* pOp)
+{
+    switch (pOp->Op())
+    {
+    case Operation::OP_OPEN:
+        return (LONGLONG)m_streams.size();
+    case Operation::OP_START:
+        return pOp->Data().vt == VT_I8 ? pOp->Data().hVal.QuadPart : TRACE_NO_VALUE;
+    case Operation::OP_SET_RATE:
+    {
+        SetRateOp* pSetRate = (SetRateOp*)pOp;
+        return PackTraceRate(pSetRate->GetRate(), pSetRate->IsThin() != FALSE);
+    }
+    default:
+        return 0;
+    }
+}
 #pragma endregion
 
+HRESULT MediaSource::GetStreamByIndex(DWORD index, MediaStream** ppStream)
+{
+    if (ppStream == NULL)
+    {
+        return E_POINTER;
+    }
+    if (index >= m_streams.size())
+    {
+        return E_INVALIDARG;
+    }
+    m_streams[index].copy_to(ppStream);
+    return S_OK;
+}
+
 HRESULT MediaSource::BeginAsyncOp(SourceOp* pOp)
 {
     if (pOp == NULL || m_currentOp != NULL)
@@ -208,6 +434,60 @@ HRESULT MediaSource::CompleteAsyncOp(SourceOp* pOp)
     return hr;
 }
 
+HRESULT MediaSource::DoOpen()
+{
+    HRESULT hr = S_OK;
+    for (size_t i = 0; i < m_streams.size(); i++)
+    {
+        hr = m_streams[i]->Open();
+        if (FAILED(hr))
+        {
+            (void)QueueEvent(MEError, GUID_NULL, hr, NULL);
+            return hr;
+        }
+    }
+    if (m_state == SourceState::STATE_OPENING)
+    {
+        m_state = SourceState::STATE_STOPPED;
+    }
+    return hr;
+}
+
+HRESULT MediaSource::DoRequestData()
+{
+    HRESULT hr = S_OK;
+    for (size_t i = 0; i < m_streams.size(); i++)
+    {
+        CHECK_HR(hr = m_streams[i]->RequestData());
+    }
+    return hr;
+}
+
+HRESULT MediaSource::DoSetRate(SetRateOp* pOp)
+{
+    HRESULT hr = S_OK;
+    m_rate = pOp->GetRate();
+    m_thin = pOp->IsThin();
+
+    // Thin whenever asked to, and always above the threshold rate.
+    bool thin = m_thin || m_rate > THINNING_THRESHOLD_RATE;
+    for (size_t i = 0; i < m_streams.size(); i++)
+    {
+        hr = m_streams[i]->SetRate(m_rate, thin);
+        if (FAILED(hr))
+        {
+            break;
+        }
+    }
+
+    PROPVARIANT var;
+    PropVariantInit(&var);
+    var.vt = VT_R4;
+    var.fltVal = m_rate;
+    (void)QueueEvent(MESourceRateChanged, GUID_NULL, hr, &var);
+    return hr;
+}
+
 HRESULT MediaSource::DoStart(StartOp* pOp)
 {
     assert(pOp->Op() == Operation::OP_START);
@@ -216,80 +496,129 @@ HRESULT MediaSource::DoStart(StartOp* pOp)
 
     HRESULT hr = S_OK;
 
+    // The event queue is built by the first op that queues an event.
+    CHECK_HR(hr = EnsureEventQueue());
+
     hr = BeginAsyncOp(pOp);
     hr = pOp->GetPresentationDescriptor(pPD.put());
 
-    // Because this sample does not support seeking, the start
-    // position must be 0 (from stopped) or "current position."
-
-    // If the sample supported seeking, we would need to get the
-    // start position from the PROPVARIANT data contained in pOp.
+    // A VT_I8 position while running is a seek into the time-shift window;
+    // the streams replay from their rings. The window kept moving while the
+    // op was queued, so a position that has left it since Start accepted it
+    // carries on from the producer instead.
+    PROPVARIANT varStart = pOp->Data();
+    bool running = m_state == SourceState::STATE_STARTED || m_state == SourceState::STATE_PAUSED;
+    if (m_timeShift && varStart.vt == VT_I8 && (running || varStart.hVal.QuadPart != 0) &&
+        !CanTimeShiftTo(varStart.hVal.QuadPart))
+    {
+        PropVariantInit(&varStart);
+    }
+    bool seeking = varStart.vt == VT_I8 && running;
 
     // Select/deselect streams, based on what the caller set in the PD.
-    hr = SelectStreams(pPD.get(), pOp->Data());
+    hr = SelectStreams(pPD.get(), varStart);
 
     m_state = SourceState::STATE_STARTED;
 
     // Queue the "started" event. The event data is the start position.
-    hr = m_eventQueue->QueueEventParamVar(MESourceStarted, GUID_NULL, S_OK, &pOp->Data());
+    MediaEventType met = seeking ? MESourceSeeked : MESourceStarted;
+    hr = m_eventQueue->QueueEventParamVar(met, GUID_NULL, S_OK, &varStart);
+    MarkStartupPhase(StartupPhase::STARTED);
     if (FAILED(hr))
     {
-        (void)m_eventQueue->QueueEventParamVar(MESourceStarted, GUID_NULL, hr, NULL);
+        (void)m_eventQueue->QueueEventParamVar(met, GUID_NULL, hr, NULL);
     }
     CompleteAsyncOp(pOp);
     return hr;
 }
 
 HRESULT MediaSource::SelectStreams(
-    IMFPresentationDescriptor* /*pPD*/,   // Presentation descriptor.
+    IMFPresentationDescriptor* pPD,   // Presentation descriptor.
     const PROPVARIANT varStart        // New start position.
 )
 {
     HRESULT hr = S_OK;
     BOOL    fSelected = FALSE;
     BOOL    fWasSelected = FALSE;
+    DWORD   cStreams = 0;
 
     winrt::com_ptr<IMFStreamDescriptor> pSD = NULL;
     winrt::com_ptr<MediaStream> pStream = NULL;
 
+    CHECK_HR(hr = EnsureEventQueue());
+
     // Reset the pending EOS count.  
     m_pendingEOS = 0;
 
+    // A VT_EMPTY start while running only changes the selection; streams
+    // that stay selected keep their queues and keep delivering.
+    bool reselecting = varStart.vt == VT_EMPTY && m_state == SourceState::STATE_STARTED;
+
+    CHECK_HR(hr = pPD->GetStreamDescriptorCount(&cStreams));
+
     // Loop throught the stream descriptors to find which streams are active.
-    for (DWORD i = 0; i < m_streams.size(); i++)
+    for (DWORD i = 0; i < cStreams; i++)
     {
+        DWORD streamId = 0;
+        pSD = nullptr;
+        CHECK_HR(hr = pPD->GetStreamDescriptorByIndex(i, &fSelected, pSD.put()));
+        CHECK_HR(hr = pSD->GetStreamIdentifier(&streamId));
+        if (streamId >= m_streams.size())
+        {
+            return E_INVALIDARG;
+        }
+        pStream = m_streams[streamId];
+
         // Was the stream active already?
-        fWasSelected = m_streams[i]->IsActive();
+        fWasSelected = pStream->IsActive();
+        if (fSelected)
+        {
+            m_pendingEOS++;
+        }
+
+        // On a reselect, streams whose selection did not change are left
+        // alone: no events, and their queues keep delivering.
+        if (reselecting && (fSelected != FALSE) == fWasSelected)
+        {
+            if (fSelected)
+            {
+                pStream->ResetSelectionStats();
+            }
+            continue;
+        }
 
         // Activate or deactivate the stream.
-        CHECK_HR(hr = m_streams[i]->Activate(fSelected));
+        CHECK_HR(hr = pStream->Activate(fSelected != FALSE));
 
         if (fSelected)
         {
-            m_pendingEOS++;
-
             if (fWasSelected)
             {
                 // This stream was previously selected. Queue the "updated stream" event.
-                CHECK_HR(hr = m_eventQueue->QueueEventParamUnk(MEUpdatedStream, GUID_NULL, hr, m_streams[i].as<IUnknown>().get()));
+                CHECK_HR(hr = m_eventQueue->QueueEventParamUnk(MEUpdatedStream, GUID_NULL, hr, pStream.as<IUnknown>().get()));
             }
             else
             {
                 // This stream was not previously selected. Queue the "new stream" event.
-                CHECK_HR(hr = m_eventQueue->QueueEventParamUnk(MENewStream, GUID_NULL, hr, m_streams[i].as<IUnknown>().get()));
+                CHECK_HR(hr = m_eventQueue->QueueEventParamUnk(MENewStream, GUID_NULL, hr, pStream.as<IUnknown>().get()));
             }
 
             // Start the stream. The stream will send the appropriate stream event.
-            CHECK_HR(hr = m_streams[i]->Start(varStart));
+            CHECK_HR(hr = pStream->Start(varStart));
         }
     }
     return hr;
 }
 
 
-MediaSource::MediaSource(CRITICAL_SECTION& critSec) : m_critSec(critSec)
+volatile LONG MediaSource::s_nextSourceId = 0;
+
+MediaSource::MediaSource(DWORD workQueue)
 {
-    m_operationQueue = winrt::make_self<OpQueue<SourceOp>>(critSec
+    m_sourceId = (uint32_t)InterlockedIncrement(&s_nextSourceId);
+    MarkStartupPhase(StartupPhase::CREATE);
+    m_lock = winrt::make_self<SourceLock>();
+    m_operationQueue = winrt::make_self<OpQueue<SourceOp>>(m_lock.get()
         , [this](SourceOp* op)->HRESULT
         {
             return ValidateOperation(op);
@@ -297,25 +626,138 @@ MediaSource::MediaSource(CRITICAL_SECTION& critSec) : m_critSec(critSec)
         [this](SourceOp* op)->HRESULT
         {
             return DispatchOperation(op);
-        });
+        },
+        workQueue);
 }
 
 MediaSource::~MediaSource()
 {
-    DeleteCriticalSection(&m_critSec);
+    // Streams only hold a raw back-pointer, so this runs even if the caller
+    // never called Shutdown. Detach everything the same way.
+    if (m_state != SourceState::STATE_SHUTDOWN)
+    {
+        (void)Shutdown();
+    }
 }
 
-void MediaSource::Create(MediaSource** pSource)
+void MediaSource::Create(MediaSource** pSource, DWORD workQueue)
 {
-    CRITICAL_SECTION critSec;
-    InitializeCriticalSection(&critSec);
-    auto source = winrt::make_self<MediaSource>(critSec);
+    auto source = winrt::make_self<MediaSource>(workQueue);
     source.copy_to(pSource);
 }
 
-void MediaSource::Initialize()
+void MediaSource::SetProducer(SampleProducer* pProducer)
 {
-    DWORD streamIndex = 0;
-    auto stream = winrt::make_self<MediaStream>(streamIndex, this);
-    m_streams.push_back(stream);
+    m_producer.copy_from(pProducer);
+}
+
+void MediaSource::Initialize(DWORD streamCount)
+{
+    // Only the stream objects are created here. Descriptors, sample pools
+    // and the first samples are prepared by OP_OPEN on the work queue, so
+    // many sources can open concurrently without blocking the caller.
+    if (m_producer != nullptr)
+    {
+        streamCount = m_producer->GetStreamCount();
+    }
+    for (DWORD streamIndex = 0; streamIndex < streamCount; streamIndex++)
+    {
+        auto stream = winrt::make_self<MediaStream>(streamIndex, this, m_producer.get());
+        m_streams.push_back(stream);
+    }
+
+    m_state = SourceState::STATE_OPENING;
+    (void)QueueAsyncOperation(Operation::OP_OPEN);
+}
+
+void MediaSource::SetPlacement(DWORD workQueue, DWORD numaNode)
+{
+    AutoLock lock(m_lock->Get());
+    m_operationQueue->SetWorkQueue(workQueue);
+    if (numaNode != m_numaNode)
+    {
+        m_numaNode = numaNode;
+
+        // This can run on a consumer's RequestSample, so the pools are
+        // rebuilt by the op queue rather than here.
+        if (!m_streams.empty())
+        {
+            (void)QueueAsyncOperation(Operation::OP_SET_PLACEMENT);
+        }
+    }
+}
+
+// Moves the stream pools to the node recorded by SetPlacement.
+HRESULT MediaSource::DoSetPlacement()
+{
+    HRESULT hr = S_OK;
+    for (size_t i = 0; i < m_streams.size(); i++)
+    {
+        CHECK_HR(hr = m_streams[i]->SetNumaNode(m_numaNode));
+    }
+    return hr;
+}
+
+void MediaSource::SetConsumerCallback(ConsumerCallback callback)
+{
+    AutoLock lock(m_lock->Get());
+    m_onConsumer = callback;
+}
+
+void MediaSource::OnConsumerRequest(const PROCESSOR_NUMBER& processor)
+{
+    ConsumerCallback callback;
+    {
+        AutoLock lock(m_lock->Get());
+        callback = m_onConsumer;
+    }
+    if (callback)
+    {
+        callback(this, processor);
+    }
+}
+
+HRESULT MediaSource::EnableTimeShift(LONGLONG window, SIZE_T ramThreshold, SIZE_T spillCapacity)
+{
+    HRESULT hr = S_OK;
+    AutoLock lock(m_lock->Get());
+    for (size_t i = 0; i < m_streams.size(); i++)
+    {
+        CHECK_HR(hr = m_streams[i]->EnableTimeShift(window, ramThreshold, spillCapacity));
+    }
+    m_timeShift = true;
+    return hr;
+}
+
+// Every active stream must still hold the position.
+bool MediaSource::CanTimeShiftTo(LONGLONG time)
+{
+    bool anyActive = false;
+    for (size_t i = 0; i < m_streams.size(); i++)
+    {
+        if (!m_streams[i]->IsActive())
+        {
+            continue;
+        }
+        if (!m_streams[i]->CanTimeShiftTo(time))
+        {
+            return false;
+        }
+        anyActive = true;
+    }
+    return anyActive;
+}
+
+void MediaSource::MarkStartupPhase(StartupPhase phase)
+{
+    // Only the first occurrence of each phase is kept.
+    (void)InterlockedCompareExchange64(&m_startupPhases[(int)phase], OpTrace::Now(), 0);
+}
+
+void MediaSource::GetStartupMetrics(StartupMetrics* pMetrics)
+{
+    for (int i = 0; i < (int)StartupPhase::COUNT; i++)
+    {
+        pMetrics->phases[i] = m_startupPhases[i];
+    }
 }
\ No newline at end of file
@@ -5,17 +5,52 @@
 
 #include "SourceOp.h"
 #include "OpQueue.h"
+#include "OpTrace.h"
+#include "SampleProducer.h"
 #include "MediaStream.h"
+#include <functional>
+
+// Startup phases timed from MediaSource::Create to the first MEMediaSample.
+enum class StartupPhase
+{
+    CREATE,
+    PD_BUILT,           // CreatePresentationDescriptor returned.
+    STARTED,            // MESourceStarted queued.
+    FIRST_DATA,         // First sample handed to any stream by the producer.
+    FIRST_DELIVERY,     // First MEMediaSample queued on any stream.
+    COUNT
+};
+
+// Trace clock timestamps (100ns units) of each phase, 0 if not reached yet.
+struct StartupMetrics
+{
+    LONGLONG phases[(int)StartupPhase::COUNT] = {};
+
+    LONGLONG Elapsed(StartupPhase phase) const
+    {
+        LONGLONG time = phases[(int)phase];
+        return time != 0 ? time - phases[(int)StartupPhase::CREATE] : 0;
+    }
+    LONGLONG TimeToFirstSample() const { return Elapsed(StartupPhase::FIRST_DELIVERY); }
+};
+
+// Above this rate only sync samples are delivered, whether or not the caller
+// asked for thinning.
+const float THINNING_THRESHOLD_RATE = 2.0f;
+const float MAX_THINNED_RATE = 128.0f;
 
 class MediaStream;
-class MediaSource :public winrt::implements<MediaSource, IMFMediaSource>
+class MediaSource :public winrt::implements<MediaSource, IMFMediaSource, IMFGetService, IMFRateControl, IMFRateSupport>
 {
 public:
-    static void Create(MediaSource** source);
+    static void Create(MediaSource** source, DWORD workQueue = MFASYNC_CALLBACK_QUEUE_STANDARD);
 
-    MediaSource(CRITICAL_SECTION&);
+    MediaSource(DWORD workQueue);
     ~MediaSource();
-    void Initialize();
+    void SetProducer(SampleProducer* pProducer);
+    // Without a producer the source has streamCount streams, fed through
+    // MediaStream::QueueSample.
+    void Initialize(DWORD streamCount = 1);
 
     // IMFMediaEventGenerator
     HRESULT GetEvent(DWORD dwFlags, IMFMediaEvent** ppEvent);
@@ -31,28 +66,79 @@ public:
     HRESULT Pause(void);
     HRESULT Shutdown(void);
 
+    // IMFGetService
+    HRESULT GetService(REFGUID guidService, REFIID riid, LPVOID* ppvObject);
+
+    // IMFRateControl
+    HRESULT SetRate(BOOL fThin, float flRate);
+    HRESULT GetRate(BOOL* pfThin, float* pflRate);
+
+    // IMFRateSupport
+    HRESULT GetSlowestRate(MFRATE_DIRECTION eDirection, BOOL fThin, float* pflRate);
+    HRESULT GetFastestRate(MFRATE_DIRECTION eDirection, BOOL fThin, float* pflRate);
+    HRESULT IsRateSupported(BOOL fThin, float flRate, float* pflNearestSupportedRate);
+
     // OpQueue
     HRESULT DispatchOperation(SourceOp* pOp);
     HRESULT ValidateOperation(SourceOp* pOp);
     HRESULT QueueAsyncOperation(Operation OpType);
 
+    uint32_t GetSourceId() const { return m_sourceId; }
+    HRESULT GetStreamByIndex(DWORD index, MediaStream** ppStream);
+    bool IsIdle() { return m_operationQueue->IsEmpty(); }
+    SourceLock* Lock() { return m_lock.get(); }
+
+    // Worker placement. Streams allocate their sample pools on the source's
+    // NUMA node; the consumer callback fires on the first RequestSample with
+    // the processor the consumer is running on. A node change after open
+    // moves the pools on the work queue.
+    typedef std::function<void(MediaSource*, const PROCESSOR_NUMBER&)> ConsumerCallback;
+    void SetPlacement(DWORD workQueue, DWORD numaNode);
+    void SetConsumerCallback(ConsumerCallback callback);
+    void OnConsumerRequest(const PROCESSOR_NUMBER& processor);
+    DWORD NumaNode() const { return m_numaNode; }
+
+    // Time-shift buffering on every stream; see MediaStream::EnableTimeShift.
+    HRESULT EnableTimeShift(LONGLONG window, SIZE_T ramThreshold, SIZE_T spillCapacity);
+
+    void MarkStartupPhase(StartupPhase phase);
+    void GetStartupMetrics(StartupMetrics* pMetrics);
+
 protected:
+    HRESULT QueueOperation(SourceOp* pOp);
+    LONGLONG TraceArguments(SourceOp* pOp);
+    HRESULT EnsureEventQueue();
     HRESULT BeginAsyncOp(SourceOp* pOp);
     HRESULT CompleteAsyncOp(SourceOp* pOp);
 
+    HRESULT DoOpen();
     HRESULT DoStart(StartOp* pOp);
+    HRESULT DoRequestData();
+    HRESULT DoSetRate(SetRateOp* pOp);
+    HRESULT DoSetPlacement();
     HRESULT SelectStreams(IMFPresentationDescriptor* pPD,const PROPVARIANT varStart);
+    bool CanTimeShiftTo(LONGLONG time);
 
 private:
-    CRITICAL_SECTION m_critSec;
+    winrt::com_ptr<SourceLock> m_lock;
     winrt::com_ptr<IMFMediaEventQueue> m_eventQueue;
     winrt::com_ptr<IMFPresentationDescriptor> m_presentationDescriptor;
-    SourceState m_state;
+    SourceState m_state = SourceState::STATE_INVALID;
 
     winrt::com_ptr<SourceOp> m_currentOp;
     winrt::com_ptr<OpQueue<SourceOp>> m_operationQueue;
 
     std::vector<winrt::com_ptr<MediaStream>> m_streams;
     DWORD m_pendingEOS = 0;
+    uint32_t m_sourceId;
+    winrt::com_ptr<SampleProducer> m_producer;
+    DWORD m_numaNode = NUMA_NO_PREFERRED_NODE;
+    ConsumerCallback m_onConsumer;
+    bool m_timeShift = false;
+    float m_rate = 1.0f;
+    BOOL m_thin = FALSE;
+    volatile LONGLONG m_startupPhases[(int)StartupPhase::COUNT] = {};
+
+    static volatile LONG s_nextSourceId;
 };
 
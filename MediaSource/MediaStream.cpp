@@ -1,65 +1,135 @@
 #include "pch.h"
 #include "MediaStream.h"
+#include "SampleSlices.h"
 
 #pragma region IMFMediaEventGenerator
 HRESULT MediaStream::GetEvent(DWORD dwFlags, IMFMediaEvent** ppEvent)
 {
-    HRESULT hr = m_eventQueue->GetEvent(dwFlags, ppEvent);
+    HRESULT hr = S_OK;
+    CHECK_HR(hr = EnsureEventQueue());
+    hr = m_eventQueue->GetEvent(dwFlags, ppEvent);
     return hr;
 }
 
 HRESULT MediaStream::BeginGetEvent(IMFAsyncCallback* pCallback, IUnknown* punkState)
 {
-    HRESULT hr = m_eventQueue->BeginGetEvent(pCallback, punkState);
+    HRESULT hr = S_OK;
+    CHECK_HR(hr = EnsureEventQueue());
+    hr = m_eventQueue->BeginGetEvent(pCallback, punkState);
     return hr;
 }
 
 HRESULT MediaStream::EndGetEvent(IMFAsyncResult* pResult, IMFMediaEvent** ppEvent)
 {
-    HRESULT hr = m_eventQueue->EndGetEvent(pResult, ppEvent);
+    HRESULT hr = S_OK;
+    CHECK_HR(hr = EnsureEventQueue());
+    hr = m_eventQueue->EndGetEvent(pResult, ppEvent);
     return hr;
 }
 
 HRESULT MediaStream::QueueEvent(MediaEventType met, REFGUID guidExtendedType, HRESULT hrStatus, const PROPVARIANT* pvValue)
 {
-    HRESULT hr = m_eventQueue->QueueEventParamVar(met, guidExtendedType, hrStatus, pvValue);
+    HRESULT hr = S_OK;
+    CHECK_HR(hr = EnsureEventQueue());
+    hr = m_eventQueue->QueueEventParamVar(met, guidExtendedType, hrStatus, pvValue);
     return hr;
 }
+
+// The event queue is only needed once the pipeline talks to the stream, so
+// it is created on first use rather than in the constructor.
+HRESULT MediaStream::EnsureEventQueue()
+{
+    AutoLock lock(m_lock->Get());
+    if (m_state == SourceState::STATE_SHUTDOWN)
+    {
+        return MF_E_SHUTDOWN;
+    }
+    if (m_eventQueue == nullptr)
+    {
+        return MFCreateEventQueue(m_eventQueue.put());
+    }
+    return S_OK;
+}
 #pragma endregion
 
-MediaStream::MediaStream(DWORD streamIndex,MediaSource* pSource)
+MediaStream::MediaStream(DWORD streamIndex, MediaSource* pSource, SampleProducer* pProducer)
 {
     m_streamIndex = streamIndex;
-    m_parentSource.copy_from(pSource);
+    m_parentSource = pSource;
+    m_producer.copy_from(pProducer);
+    m_lock.copy_from(pSource->Lock());
 
-    MFCreateEventQueue(m_eventQueue.put());
-    InitializeCriticalSection(&m_critSec);
-
-    GenerateStreamDescriptor();
+    // The event queue and stream descriptor are built on demand.
 }
 
 MediaStream::~MediaStream()
 {
 }
 
+// Called by the source when it shuts down or is destroyed.
+HRESULT MediaStream::Shutdown()
+{
+    AutoLock lock(m_lock->Get());
+    m_state = SourceState::STATE_SHUTDOWN;
+    if (m_eventQueue != nullptr)
+    {
+        (void)m_eventQueue->Shutdown();
+        m_eventQueue = nullptr;
+    }
+    while (!m_samples.empty())
+    {
+        m_samples.pop();
+    }
+    while (!m_requests.empty())
+    {
+        m_requests.pop();
+    }
+    m_samplePool = nullptr;
+    if (m_producer != nullptr)
+    {
+        m_producer->SetDataReadyCallback(m_streamIndex, nullptr);
+    }
+    if (m_decryptQueue != nullptr)
+    {
+        m_decryptQueue->SetDataReadyCallback(nullptr);
+        m_decryptQueue->Cancel();
+        m_decryptQueue = nullptr;
+    }
+    m_producer = nullptr;
+    m_parentSource = nullptr;
+    m_timeShift = nullptr;
+    return S_OK;
+}
+
 HRESULT MediaStream::GetMediaType(IMFMediaType** type)
 {
     if (type == NULL)
     {
         return E_POINTER;
     }
-    //TODO:: Create MediaType here
-    return S_OK;
+    if (m_producer == nullptr)
+    {
+        //TODO:: Create MediaType here
+        return S_OK;
+    }
+    return m_producer->GetMediaType(m_streamIndex, type);
 }
 
 HRESULT MediaStream::GenerateStreamDescriptor()
 {
+    AutoLock lock(m_lock->Get());
+    if (m_streamDesc != nullptr)
+    {
+        return S_OK;
+    }
+
+    HRESULT hr = S_OK;
     winrt::com_ptr<IMFMediaType> media_type;
-    GetMediaType(media_type.put());
+    CHECK_HR(hr = GetMediaType(media_type.put()));
 
     IMFMediaType* mediaTypes = media_type.get();
-    MFCreateStreamDescriptor(m_streamIndex, 1, &mediaTypes,m_streamDesc.put());
-    return S_OK;
+    hr = MFCreateStreamDescriptor(m_streamIndex, 1, &mediaTypes, m_streamDesc.put());
+    return hr;
 }
 
 HRESULT MediaStream::GetMediaSource(IMFMediaSource** ppMediaSource)
@@ -68,11 +138,13 @@ HRESULT MediaStream::GetMediaSource(IMFMediaSource** ppMediaSource)
     {
         return E_POINTER;
     }
+    AutoLock lock(m_lock->Get());
     if (m_parentSource == NULL)
     {
-        return E_UNEXPECTED;
+        return MF_E_SHUTDOWN;
     }
-    auto re = m_parentSource.as<IMFMediaSource>();
+    winrt::com_ptr<IMFMediaSource> re;
+    re.copy_from(static_cast<IMFMediaSource*>(m_parentSource));
     re.copy_to(ppMediaSource);
     return S_OK;
 }
@@ -83,10 +155,13 @@ HRESULT MediaStream::GetStreamDescriptor(IMFStreamDescriptor** ppStreamDescripto
     {
         return E_POINTER;
     }
-    if (m_streamDesc == NULL)
+    if (m_state == SourceState::STATE_SHUTDOWN)
     {
-        return E_UNEXPECTED;
+        return MF_E_SHUTDOWN;
     }
+
+    HRESULT hr = S_OK;
+    CHECK_HR(hr = GenerateStreamDescriptor());
     m_streamDesc.copy_to(ppStreamDescriptor);
     return S_OK;
 }
@@ -94,7 +169,12 @@ HRESULT MediaStream::GetStreamDescriptor(IMFStreamDescriptor** ppStreamDescripto
 HRESULT MediaStream::RequestSample(IUnknown* pToken)
 {
     HRESULT hr = S_OK;
-    AutoLock locker(m_critSec);
+    AutoLock locker(m_lock->Get());
+
+    if (m_state == SourceState::STATE_SHUTDOWN)
+    {
+        return MF_E_SHUTDOWN;
+    }
 
     if (m_state == SourceState::STATE_STOPPED)
     {
@@ -108,14 +188,23 @@ HRESULT MediaStream::RequestSample(IUnknown* pToken)
     }
 
     // Fail if we reached the end of the stream AND the sample queue is empty,
-    if (m_eos && m_samples.empty())
+    if (m_eos && m_samples.empty() && PendingDecrypts() == 0)
     {
         CHECK_HR(hr = MF_E_END_OF_STREAM);
     }
 
+    if (!m_consumerSeen)
+    {
+        m_consumerSeen = true;
+        PROCESSOR_NUMBER processor;
+        GetCurrentProcessorNumberEx(&processor);
+        m_parentSource->OnConsumerRequest(processor);
+    }
+
     winrt::com_ptr<IUnknown> token;
     token.copy_from(pToken);
     m_requests.push(token);
+    OpTrace::Record(TraceEvent::SAMPLE_REQUEST, m_parentSource->GetSourceId(), (uint16_t)m_streamIndex, 0, 0);
 
     // Dispatch the request.
     CHECK_HR(hr = DispatchSamples());
@@ -135,18 +224,45 @@ HRESULT MediaStream::DispatchSamples()
     winrt::com_ptr<IMFSample> pSample = NULL;
     winrt::com_ptr<IUnknown> pToken = NULL;
 
-    AutoLock lock(m_critSec);
+    AutoLock lock(m_lock->Get());
 
     if (m_state != SourceState::STATE_STARTED)
     {
         return S_OK;
     }
 
-    // Deliver as many samples as we can.
-    while (!m_samples.empty() && !m_requests.empty())
+    // Deliver as many samples as we can. While replaying a time-shift
+    // position, samples come from the ring until it reaches the live edge.
+    while (!m_requests.empty())
     {
-        pSample = m_samples.front();
-        m_samples.pop();
+        bool fromRing = false;
+        pSample = nullptr;
+        if (m_replaying)
+        {
+            CHECK_HR(hr = m_timeShift->GetNext(&m_replaySequence, pSample.put()));
+            fromRing = hr == S_OK;
+            m_replaying = fromRing;
+            hr = S_OK;
+        }
+        if (!fromRing)
+        {
+            if (m_samples.empty())
+            {
+                break;
+            }
+            pSample = m_samples.front();
+            m_samples.pop();
+        }
+
+        if (m_thinning && !MFGetAttributeUINT32(pSample.get(), MFSampleExtension_CleanPoint, FALSE))
+        {
+            continue;
+        }
+        if (m_discontinuity)
+        {
+            m_discontinuity = false;
+            CHECK_HR(hr = pSample->SetUINT32(MFSampleExtension_Discontinuity, TRUE));
+        }
 
         pToken = m_requests.front();
         m_requests.pop();
@@ -156,10 +272,54 @@ HRESULT MediaStream::DispatchSamples()
             CHECK_HR(hr = pSample->SetUnknown(MFSampleExtension_Token, pToken.get()));
         }
 
+        if (m_contiguousDelivery)
+        {
+            winrt::com_ptr<IMFMediaBuffer> buffer;
+            CHECK_HR(hr = SampleSlices::GetContiguousBuffer(pSample.get(), buffer.put()));
+        }
+
         CHECK_HR(hr = m_eventQueue->QueueEventParamUnk(MEMediaSample, GUID_NULL, S_OK, pSample.get()));
+
+        if (fromRing)
+        {
+            if (m_seekStartTime != 0)
+            {
+                m_lastSeekLatency = OpTrace::Now() - m_seekStartTime;
+                m_seekStartTime = 0;
+            }
+        }
+        else if (m_timeShift != nullptr)
+        {
+            CHECK_HR(hr = m_timeShift->Append(pSample.get()));
+        }
+
+        LONGLONG now = OpTrace::Now();
+        if (m_activatedTime != 0)
+        {
+            m_selectionStats.timeToFirstSample = now - m_activatedTime;
+            m_activatedTime = 0;
+        }
+        if (m_lastDeliveryTime != 0 && now - m_lastDeliveryTime > m_selectionStats.maxDeliveryGap)
+        {
+            m_selectionStats.maxDeliveryGap = now - m_lastDeliveryTime;
+        }
+        m_lastDeliveryTime = now;
+
+        if (!m_delivered)
+        {
+            m_delivered = true;
+            m_parentSource->MarkStartupPhase(StartupPhase::FIRST_DELIVERY);
+        }
+
+        if (OpTrace::IsRecording())
+        {
+            LONGLONG sampleTime = 0;
+            (void)pSample->GetSampleTime(&sampleTime);
+            OpTrace::Record(TraceEvent::SAMPLE_DELIVERY, m_parentSource->GetSourceId(), (uint16_t)m_streamIndex, 0, sampleTime);
+        }
     }
 
-    if (m_samples.empty() && m_eos)
+    if (m_samples.empty() && m_eos && !m_replaying && PendingDecrypts() == 0)
     {
         // The sample queue is empty AND we have reached the end of the source stream.
         // Notify the pipeline by sending the end-of-stream event.
@@ -168,7 +328,7 @@ HRESULT MediaStream::DispatchSamples()
         // Also notify the source, so that it can send the end-of-presentation event.
         CHECK_HR(hr = m_parentSource->QueueAsyncOperation(Operation::OP_END_OF_STREAM));
     }
-    else if ((m_active && !m_eos && (m_samples.size() < SAMPLE_QUEUE)))
+    else if (m_active && !m_eos && !m_dataPending && m_samples.size() + PendingDecrypts() < SAMPLE_QUEUE)
     {
         // The sample queue is empty and the request queue is not empty (and we did not
         // reach the end of the stream). Ask the source for more data.
@@ -185,7 +345,8 @@ HRESULT MediaStream::DispatchSamples()
 
 HRESULT MediaStream::Activate(bool bActive)
 {
-    AutoLock lock(m_critSec);
+    AutoLock lock(m_lock->Get());
+    HRESULT hr = S_OK;
 
     if (bActive == m_active)
     {
@@ -194,6 +355,7 @@ HRESULT MediaStream::Activate(bool bActive)
 
     m_active = bActive;
 
+    // Only this stream's queues are touched; the others keep delivering.
     if (!bActive)
     {
         while (m_samples.size() > 0)
@@ -204,18 +366,60 @@ HRESULT MediaStream::Activate(bool bActive)
         {
             m_requests.pop();
         }
+        if (m_decryptQueue != nullptr)
+        {
+            m_decryptQueue->Cancel();
+        }
+        m_dataPending = false;
+        m_replaying = false;
+        m_activatedTime = 0;
     }
-    return S_OK;
+    else
+    {
+        m_activatedTime = OpTrace::Now();
+        m_lastDeliveryTime = 0;
+        m_selectionStats = SelectionStats();
+    }
+
+    if (m_producer != nullptr)
+    {
+        CHECK_HR(hr = m_producer->SelectStream(m_streamIndex, bActive));
+    }
+    return hr;
+}
+
+void MediaStream::ResetSelectionStats()
+{
+    AutoLock lock(m_lock->Get());
+    m_selectionStats.maxDeliveryGap = 0;
+}
+
+void MediaStream::GetSelectionStats(SelectionStats* pStats)
+{
+    AutoLock lock(m_lock->Get());
+    *pStats = m_selectionStats;
 }
 
 
 HRESULT MediaStream::Start(const PROPVARIANT& varStart)
 {
-    AutoLock lock(m_critSec);
+    AutoLock lock(m_lock->Get());
     HRESULT hr = S_OK;
-    // Queue the stream-started event.
+    bool seeking = false;
+
+    // A position inside the time-shift window is served from the ring.
+    if (varStart.vt == VT_I8 && m_timeShift != nullptr && m_timeShift->Contains(varStart.hVal.QuadPart))
+    {
+        CHECK_HR(hr = m_timeShift->Seek(varStart.hVal.QuadPart, &m_replaySequence));
+        seeking = m_state == SourceState::STATE_STARTED || m_state == SourceState::STATE_PAUSED;
+        m_replaying = true;
+        m_discontinuity = true;
+        m_seekStartTime = OpTrace::Now();
+    }
+
+    // Queue the stream-started (or seeked) event.
     CHECK_HR(hr = QueueEvent(
-        MEStreamStarted,
+        seeking ? MEStreamSeeked : MEStreamStarted,
         GUID_NULL,
         S_OK,
         &varStart
@@ -227,4 +431,317 @@ HRESULT MediaStream::Start(const PROPVARIANT& varStart)
     // queue sample requests. Dispatch them now.
     CHECK_HR(hr = DispatchSamples());
     return hr;
+}
+
+HRESULT MediaStream::QueueSample(IMFSample* pSample)
+{
+    if (pSample == NULL)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+    AutoLock lock(m_lock->Get());
+    if (m_state == SourceState::STATE_SHUTDOWN)
+    {
+        return MF_E_SHUTDOWN;
+    }
+
+    DWORD length = 0;
+    (void)pSample->GetTotalLength(&length);
+    m_bytesRead += length;
+    if (m_decryptQueue != nullptr)
+    {
+        // Pushed samples are decrypted like read ones; CollectDecrypted
+        // delivers them in order.
+        CHECK_HR(hr = m_decryptQueue->Submit(pSample, m_samplePool.get()));
+        CHECK_HR(hr = CollectDecrypted());
+    }
+    else
+    {
+        PushSample(pSample);
+    }
+    CHECK_HR(hr = DispatchSamples());
+    return hr;
+}
+
+// Called with the source lock held.
+void MediaStream::PushSample(IMFSample* pSample)
+{
+    if (OpTrace::IsRecording())
+    {
+        LONGLONG sampleTime = 0;
+        (void)pSample->GetSampleTime(&sampleTime);
+        OpTrace::Record(TraceEvent::SAMPLE_ARRIVAL, m_parentSource->GetSourceId(), (uint16_t)m_streamIndex, 0, sampleTime);
+    }
+
+    winrt::com_ptr<IMFSample> sample;
+    sample.copy_from(pSample);
+    m_samples.push(sample);
+    m_parentSource->MarkStartupPhase(StartupPhase::FIRST_DATA);
+}
+
+HRESULT MediaStream::Open()
+{
+    HRESULT hr = S_OK;
+    CHECK_HR(hr = GenerateStreamDescriptor());
+    if (m_producer == nullptr)
+    {
+        return S_OK;
+    }
+
+    AutoLock lock(m_lock->Get());
+    if (m_state == SourceState::STATE_SHUTDOWN)
+    {
+        return MF_E_SHUTDOWN;
+    }
+
+    auto pool = winrt::make_self<SamplePool>(m_producer->GetMaxSampleSize(m_streamIndex), m_parentSource->NumaNode());
+    CHECK_HR(hr = pool->Prewarm(SAMPLE_QUEUE * 2));
+    m_samplePool = pool;
+
+    // The producer may outlive the stream, so it only gets a weak reference.
+    winrt::weak_ref<MediaStream> weak = get_weak();
+    m_producer->SetDataReadyCallback(m_streamIndex, [weak]()
+        {
+            if (auto stream = weak.get())
+            {
+                stream->OnDataReady();
+            }
+        });
+
+    if (m_decryptor != nullptr)
+    {
+        CHECK_HR(hr = StartDecryptQueue());
+    }
+
+    // Pre-read the first samples so they are ready when the pipeline starts.
+    CHECK_HR(hr = ReadSamples());
+    return hr;
+}
+
+void MediaStream::SetContiguousDelivery(bool bContiguous)
+{
+    AutoLock lock(m_lock->Get());
+    m_contiguousDelivery = bContiguous;
+}
+
+HRESULT MediaStream::SetDecryptor(CencDecryptor* pDecryptor)
+{
+    HRESULT hr = S_OK;
+    AutoLock lock(m_lock->Get());
+    if (m_state == SourceState::STATE_SHUTDOWN)
+    {
+        return MF_E_SHUTDOWN;
+    }
+    m_decryptor.copy_from(pDecryptor);
+
+    // A stream without a producer only has samples pushed to it and needs
+    // the queue straight away; otherwise Open starts it.
+    if (m_samplePool != nullptr || m_producer == nullptr)
+    {
+        CHECK_HR(hr = StartDecryptQueue());
+    }
+    return hr;
+}
+
+// Called with the source lock held. Samples already submitted to a previous
+// queue are dropped with it.
+HRESULT MediaStream::StartDecryptQueue()
+{
+    if (m_decryptQueue != nullptr)
+    {
+        m_decryptQueue->SetDataReadyCallback(nullptr);
+        m_decryptQueue->Cancel();
+        m_decryptQueue = nullptr;
+    }
+    if (m_decryptor == nullptr)
+    {
+        return S_OK;
+    }
+
+    m_decryptQueue = winrt::make_self<DecryptQueue>(m_decryptor.get());
+    winrt::weak_ref<MediaStream> weak = get_weak();
+    m_decryptQueue->SetDataReadyCallback([weak]()
+        {
+            if (auto stream = weak.get())
+            {
+                stream->OnDataReady();
+            }
+        });
+    return S_OK;
+}
+
+HRESULT MediaStream::EnableTimeShift(LONGLONG window, SIZE_T ramThreshold, SIZE_T spillCapacity)
+{
+    AutoLock lock(m_lock->Get());
+    if (m_state == SourceState::STATE_SHUTDOWN)
+    {
+        return MF_E_SHUTDOWN;
+    }
+    m_timeShift = std::make_unique<TimeShiftBuffer>(window, ramThreshold, spillCapacity);
+    m_replaying = false;
+    return S_OK;
+}
+
+bool MediaStream::CanTimeShiftTo(LONGLONG time)
+{
+    AutoLock lock(m_lock->Get());
+    return m_timeShift != nullptr && m_timeShift->Contains(time);
+}
+
+void MediaStream::GetTimeShiftStats(TimeShiftStats* pStats)
+{
+    AutoLock lock(m_lock->Get());
+    *pStats = TimeShiftStats();
+    if (m_timeShift != nullptr)
+    {
+        m_timeShift->GetStats(pStats);
+    }
+    pStats->lastSeekLatency = m_lastSeekLatency;
+}
+
+HRESULT MediaStream::SetRate(float rate, bool thin)
+{
+    HRESULT hr = S_OK;
+    AutoLock lock(m_lock->Get());
+    if (m_state == SourceState::STATE_SHUTDOWN)
+    {
+        return MF_E_SHUTDOWN;
+    }
+    if (thin != m_thinning)
+    {
+        m_thinning = thin;
+        m_discontinuity = true;
+    }
+    if (m_producer != nullptr)
+    {
+        CHECK_HR(hr = m_producer->SetRate(m_streamIndex, rate, thin));
+    }
+    return hr;
+}
+
+// Samples already queued stay in the old pool and return there.
+HRESULT MediaStream::SetNumaNode(DWORD numaNode)
+{
+    HRESULT hr = S_OK;
+    AutoLock lock(m_lock->Get());
+    if (m_samplePool == nullptr || m_samplePool->NumaNode() == numaNode)
+    {
+        return S_OK;
+    }
+
+    auto pool = winrt::make_self<SamplePool>(m_samplePool->BufferSize(), numaNode);
+    CHECK_HR(hr = pool->Prewarm(SAMPLE_QUEUE * 2));
+    m_samplePool = pool;
+    return hr;
+}
+
+HRESULT MediaStream::RequestData()
+{
+    HRESULT hr = S_OK;
+    AutoLock lock(m_lock->Get());
+    if (!m_active)
+    {
+        return S_OK;
+    }
+
+    if (m_samplePool != nullptr)
+    {
+        hr = ReadSamples();
+        if (SUCCEEDED(hr))
+        {
+            hr = DispatchSamples();
+        }
+    }
+    else
+    {
+        // Without a producer there is nothing to read, only pushed samples
+        // the decrypt queue has finished.
+        hr = CollectDecrypted();
+        if (SUCCEEDED(hr) && !m_samples.empty())
+        {
+            hr = DispatchSamples();
+        }
+    }
+
+    // A read or decrypt that failed has dropped its sample. Queue MEError
+    // from the source (except after shutdown), as for a failed delivery.
+    if (FAILED(hr) && (m_state != SourceState::STATE_SHUTDOWN))
+    {
+        m_parentSource->QueueEvent(MEError, GUID_NULL, hr, NULL);
+    }
+    return hr;
+}
+
+// Called by the producer from its I/O thread. The read itself happens on
+// the OpQueue worker, like any other request for data.
+void MediaStream::OnDataReady()
+{
+    AutoLock lock(m_lock->Get());
+    if (m_state == SourceState::STATE_SHUTDOWN || m_parentSource == nullptr)
+    {
+        return;
+    }
+    m_dataPending = false;
+    (void)m_parentSource->QueueAsyncOperation(Operation::OP_REQUEST_DATA);
+}
+
+// Called with the source lock held. Decrypted samples move to m_samples in
+// the order they were read.
+HRESULT MediaStream::CollectDecrypted()
+{
+    HRESULT hr = S_OK;
+    while (m_decryptQueue != nullptr)
+    {
+        winrt::com_ptr<IMFSample> sample;
+        hr = m_decryptQueue->GetCompleted(sample.put());
+        if (hr != S_OK)
+        {
+            return hr == E_PENDING || hr == S_FALSE ? S_OK : hr;
+        }
+        PushSample(sample.get());
+    }
+    return hr;
+}
+
+// Called with the source lock held.
+HRESULT MediaStream::ReadSamples()
+{
+    HRESULT hr = S_OK;
+    m_dataPending = false;
+    CHECK_HR(hr = CollectDecrypted());
+    while (!m_eos && m_samples.size() + PendingDecrypts() < SAMPLE_QUEUE)
+    {
+        winrt::com_ptr<IMFSample> sample;
+        hr = m_producer->ReadSample(m_streamIndex, m_samplePool.get(), sample.put());
+        if (hr == MF_E_END_OF_STREAM)
+        {
+            m_eos = true;
+            return S_OK;
+        }
+        if (hr == E_PENDING)
+        {
+            // OnDataReady asks again once the producer's read completes.
+            m_dataPending = true;
+            return S_OK;
+        }
+        CHECK_HR(hr);
+
+        DWORD length = 0;
+        (void)sample->GetTotalLength(&length);
+        m_bytesRead += length;
+        if (m_thinning && !MFGetAttributeUINT32(sample.get(), MFSampleExtension_CleanPoint, FALSE))
+        {
+            continue;
+        }
+        if (m_decryptQueue != nullptr)
+        {
+            CHECK_HR(hr = m_decryptQueue->Submit(sample.get(), m_samplePool.get()));
+            CHECK_HR(hr = CollectDecrypted());
+            continue;
+        }
+        PushSample(sample.get());
+    }
+    return hr;
 }
\ No newline at end of file
@@ -1,15 +1,26 @@
 #pragma once
 #include <mfidl.h>
 #include "MediaSource.h"
+#include "SampleProducer.h"
+#include "TimeShiftBuffer.h"
+#include "CencDecryptor.h"
 #include <queue>
+#include <memory>
 
 const DWORD SAMPLE_QUEUE = 2;
 class MediaSource;
 
+// Delivery timing around a selection change, in 100ns units.
+struct SelectionStats
+{
+    LONGLONG timeToFirstSample = 0; // From activation to first delivery.
+    LONGLONG maxDeliveryGap = 0;    // Longest gap between deliveries since the last reset.
+};
+
 class MediaStream: public winrt::implements<MediaStream, IMFMediaStream>
 {
 public:
-    MediaStream(DWORD streamIndex, MediaSource* pSource);
+    MediaStream(DWORD streamIndex, MediaSource* pSource, SampleProducer* pProducer);
     ~MediaStream();
 
     // IMFMediaEventGenerator
@@ -31,20 +42,81 @@ public:
     HRESULT Activate(bool bActive);
     HRESULT Start(const PROPVARIANT& varStart);
 
+    // Producer side: push a sample and deliver it if a request is waiting.
+    // With a decryptor set it is decrypted first, like a read sample.
+    HRESULT QueueSample(IMFSample* pSample);
+
+    // Called from the source's OpQueue worker.
+    HRESULT Open();
+    HRESULT RequestData();
+    HRESULT Shutdown();
+    HRESULT SetNumaNode(DWORD numaNode);
+
+    // Scatter-gather samples are delivered as-is unless the consumer asks
+    // for contiguous payloads, in which case they are flattened on delivery.
+    void SetContiguousDelivery(bool bContiguous);
+
+    // Keep delivered samples for instant rewind. Start() at a position inside
+    // the window replays from the ring without asking the producer.
+    HRESULT EnableTimeShift(LONGLONG window, SIZE_T ramThreshold, SIZE_T spillCapacity);
+    bool CanTimeShiftTo(LONGLONG time);
+    void GetTimeShiftStats(TimeShiftStats* pStats);
+
+    // Decrypt Common Encryption samples between the producer and the sample
+    // queue, on the thread pool, before they are delivered.
+    HRESULT SetDecryptor(CencDecryptor* pDecryptor);
+
+    // Thinned (keyframe-only) delivery for fast playback.
+    HRESULT SetRate(float rate, bool thin);
+    LONGLONG GetBytesRead() const { return m_bytesRead; }
+
+    void ResetSelectionStats();
+    void GetSelectionStats(SelectionStats* pStats);
+
 protected:
     HRESULT DispatchSamples();
+    HRESULT EnsureEventQueue();
+    HRESULT ReadSamples();
+    HRESULT CollectDecrypted();
+    HRESULT StartDecryptQueue();
+    size_t PendingDecrypts() { return m_decryptQueue != nullptr ? m_decryptQueue->QueuedCount() : 0; }
+    void PushSample(IMFSample* pSample);
+    void OnDataReady();
 
 private:
-    CRITICAL_SECTION m_critSec;
-    winrt::com_ptr<MediaSource> m_parentSource;
+    winrt::com_ptr<SourceLock> m_lock;     // Shared with the parent source.
+    MediaSource* m_parentSource;            // Not a reference; cleared by Shutdown.
     winrt::com_ptr<IMFStreamDescriptor> m_streamDesc;
     winrt::com_ptr<IMFMediaEventQueue> m_eventQueue;
     SourceState m_state = SourceState::STATE_INVALID;
-    bool m_active;
-    bool m_eos;
+    bool m_active = false;
+    bool m_eos = false;
+    bool m_delivered = false;
+    bool m_consumerSeen = false;
+    bool m_contiguousDelivery = false;
+
+    std::unique_ptr<TimeShiftBuffer> m_timeShift;
+    bool m_replaying = false;
+    ULONGLONG m_replaySequence = 0;
+    LONGLONG m_seekStartTime = 0;
+    LONGLONG m_lastSeekLatency = 0;
+
+    bool m_thinning = false;
+    bool m_discontinuity = false;
+    LONGLONG m_bytesRead = 0;       // Payload received from the producer.
+    bool m_dataPending = false;     // The producer or decryptor will call OnDataReady.
+
+    LONGLONG m_activatedTime = 0;   // Pending until the first delivery.
+    LONGLONG m_lastDeliveryTime = 0;
+    SelectionStats m_selectionStats;
     std::queue<winrt::com_ptr<IMFSample>> m_samples;
     std::queue<winrt::com_ptr<IUnknown>> m_requests;
     DWORD m_streamIndex;
+
+    winrt::com_ptr<SampleProducer> m_producer;
+    winrt::com_ptr<SamplePool> m_samplePool;
+    winrt::com_ptr<CencDecryptor> m_decryptor;
+    winrt::com_ptr<DecryptQueue> m_decryptQueue;
 };
 
 class AutoLock
@@ -52,7 +124,7 @@ class AutoLock
 private:
     LPCRITICAL_SECTION m_critSec;
 public:
-    AutoLock(CRITICAL_SECTION critSec)
+    AutoLock(CRITICAL_SECTION& critSec)
     {
         m_critSec = &critSec;
         EnterCriticalSection(m_critSec);
@@ -0,0 +1,114 @@
+#include "pch.h"
+#include "MemoryBuffer.h"
+
+HRESULT MemorySlab::Create(SIZE_T size, DWORD numaNode, MemorySlab** ppSlab)
+{
+    if (ppSlab == NULL)
+    {
+        return E_POINTER;
+    }
+
+    auto slab = winrt::make_self<MemorySlab>();
+    if (numaNode == NUMA_NO_PREFERRED_NODE)
+    {
+        slab->m_data = (BYTE*)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+    else
+    {
+        slab->m_data = (BYTE*)VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, numaNode);
+    }
+    if (slab->m_data == nullptr)
+    {
+        return E_OUTOFMEMORY;
+    }
+    slab->m_size = size;
+    *ppSlab = slab.detach();
+    return S_OK;
+}
+
+MemorySlab::MemorySlab()
+{
+}
+
+MemorySlab::~MemorySlab()
+{
+    if (m_data != nullptr)
+    {
+        VirtualFree(m_data, 0, MEM_RELEASE);
+    }
+}
+
+HRESULT SliceBuffer::Create(IUnknown* pOwner, BYTE* pData, DWORD maxLength, DWORD currentLength, IMFMediaBuffer** ppBuffer)
+{
+    if (ppBuffer == NULL || pData == NULL)
+    {
+        return E_POINTER;
+    }
+    if (currentLength > maxLength)
+    {
+        return E_INVALIDARG;
+    }
+
+    auto buffer = winrt::make_self<SliceBuffer>(pOwner, pData, maxLength, currentLength);
+    *ppBuffer = buffer.as<IMFMediaBuffer>().detach();
+    return S_OK;
+}
+
+SliceBuffer::SliceBuffer(IUnknown* pOwner, BYTE* pData, DWORD maxLength, DWORD currentLength)
+    : m_data(pData), m_maxLength(maxLength), m_currentLength(currentLength)
+{
+    m_owner.copy_from(pOwner);
+}
+
+HRESULT SliceBuffer::Lock(BYTE** ppbBuffer, DWORD* pcbMaxLength, DWORD* pcbCurrentLength)
+{
+    if (ppbBuffer == NULL)
+    {
+        return E_POINTER;
+    }
+    *ppbBuffer = m_data;
+    if (pcbMaxLength != NULL)
+    {
+        *pcbMaxLength = m_maxLength;
+    }
+    if (pcbCurrentLength != NULL)
+    {
+        *pcbCurrentLength = m_currentLength;
+    }
+    return S_OK;
+}
+
+HRESULT SliceBuffer::Unlock()
+{
+    return S_OK;
+}
+
+HRESULT SliceBuffer::GetCurrentLength(DWORD* pcbCurrentLength)
+{
+    if (pcbCurrentLength == NULL)
+    {
+        return E_POINTER;
+    }
+    *pcbCurrentLength = m_currentLength;
+    return S_OK;
+}
+
+HRESULT SliceBuffer::SetCurrentLength(DWORD cbCurrentLength)
+{
+    if (cbCurrentLength > m_maxLength)
+    {
+        return E_INVALIDARG;
+    }
+    m_currentLength = cbCurrentLength;
+    return S_OK;
+}
+
+HRESULT SliceBuffer::GetMaxLength(DWORD* pcbMaxLength)
+{
+    if (pcbMaxLength == NULL)
+    {
+        return E_POINTER;
+    }
+    *pcbMaxLength = m_maxLength;
+    return S_OK;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <mfapi.h>
+
+// Block of committed memory, optionally from a preferred NUMA node. Buffers
+// carved out of it keep it alive through their owner reference.
+class MemorySlab : public winrt::implements<MemorySlab, IUnknown>
+{
+public:
+    static HRESULT Create(SIZE_T size, DWORD numaNode, MemorySlab** ppSlab);
+
+    MemorySlab();
+    ~MemorySlab();
+
+    BYTE* Data() const { return m_data; }
+    SIZE_T Size() const { return m_size; }
+
+private:
+    BYTE* m_data = nullptr;
+    SIZE_T m_size = 0;
+};
+
+// IMFMediaBuffer over memory it does not own. The owner is held for the
+// lifetime of the buffer.
+class SliceBuffer : public winrt::implements<SliceBuffer, IMFMediaBuffer>
+{
+public:
+    static HRESULT Create(IUnknown* pOwner, BYTE* pData, DWORD maxLength, DWORD currentLength, IMFMediaBuffer** ppBuffer);
+
+    SliceBuffer(IUnknown* pOwner, BYTE* pData, DWORD maxLength, DWORD currentLength);
+
+    // IMFMediaBuffer
+    STDMETHODIMP Lock(BYTE** ppbBuffer, DWORD* pcbMaxLength, DWORD* pcbCurrentLength);
+    STDMETHODIMP Unlock();
+    STDMETHODIMP GetCurrentLength(DWORD* pcbCurrentLength);
+    STDMETHODIMP SetCurrentLength(DWORD cbCurrentLength);
+    STDMETHODIMP GetMaxLength(DWORD* pcbMaxLength);
+
+private:
+    winrt::com_ptr<IUnknown> m_owner;
+    BYTE* m_data;
+    DWORD m_maxLength;
+    volatile DWORD m_currentLength;
+};
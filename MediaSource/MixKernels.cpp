@@ -0,0 +1,72 @@
+#include "pch.h"
+#include "MixKernels.h"
+#include <immintrin.h>
+
+typedef void(*MixFunction)(float* pDst, const float* pSrc, float gain, size_t count);
+
+static void MixScalar(float* pDst, const float* pSrc, float gain, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        pDst[i] += pSrc[i] * gain;
+    }
+}
+
+static void MixSse2(float* pDst, const float* pSrc, float gain, size_t count)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128 d0 = _mm_loadu_ps(pDst + i);
+        __m128 d1 = _mm_loadu_ps(pDst + i + 4);
+        d0 = _mm_add_ps(d0, _mm_mul_ps(_mm_loadu_ps(pSrc + i), g));
+        d1 = _mm_add_ps(d1, _mm_mul_ps(_mm_loadu_ps(pSrc + i + 4), g));
+        _mm_storeu_ps(pDst + i, d0);
+        _mm_storeu_ps(pDst + i + 4, d1);
+    }
+    MixScalar(pDst + i, pSrc + i, gain, count - i);
+}
+
+// AVX2 implies AVX; FMA is a separate feature, so multiply and add are kept
+// apart.
+static void MixAvx2(float* pDst, const float* pSrc, float gain, size_t count)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256 d0 = _mm256_loadu_ps(pDst + i);
+        __m256 d1 = _mm256_loadu_ps(pDst + i + 8);
+        d0 = _mm256_add_ps(d0, _mm256_mul_ps(_mm256_loadu_ps(pSrc + i), g));
+        d1 = _mm256_add_ps(d1, _mm256_mul_ps(_mm256_loadu_ps(pSrc + i + 8), g));
+        _mm256_storeu_ps(pDst + i, d0);
+        _mm256_storeu_ps(pDst + i + 8, d1);
+    }
+    MixSse2(pDst + i, pSrc + i, gain, count - i);
+}
+
+static MixFunction GetMixFunction(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::AVX2:
+        return MixAvx2;
+    case SimdLevel::SSE2:
+        return MixSse2;
+    default:
+        return MixScalar;
+    }
+}
+
+static const MixFunction s_mix = GetMixFunction(CpuFeatures::GetSimdLevel());
+
+void MixKernels::Mix(float* pDst, const float* pSrc, float gain, size_t count)
+{
+    s_mix(pDst, pSrc, gain, count);
+}
+
+void MixKernels::MixWith(SimdLevel level, float* pDst, const float* pSrc, float gain, size_t count)
+{
+    GetMixFunction(level)(pDst, pSrc, gain, count);
+}
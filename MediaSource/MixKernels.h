@@ -0,0 +1,12 @@
+#pragma once
+#include "CpuFeatures.h"
+
+// Gain-and-sum kernels for mixing interleaved float PCM. Mix uses the widest
+// instruction set the CPU supports; MixWith runs a given level.
+class MixKernels
+{
+public:
+    // pDst[i] += pSrc[i] * gain, for count floats.
+    static void Mix(float* pDst, const float* pSrc, float gain, size_t count);
+    static void MixWith(SimdLevel level, float* pDst, const float* pSrc, float gain, size_t count);
+};
@@ -0,0 +1,481 @@
+#include "pch.h"
+#include "MixerProducer.h"
+#include "MixKernels.h"
+#include "SampleSlices.h"
+#include <algorithm>
+
+// Sample requests kept outstanding on each input stream.
+const DWORD MIXER_INPUT_REQUESTS = 2;
+
+MixerProducer::MixerProducer(DWORD sampleRate, DWORD channels, DWORD blockFrames, LONGLONG deadline)
+    : m_sampleRate(sampleRate),
+    m_channels(channels),
+    m_blockFrames(blockFrames),
+    m_deadline(deadline),
+    m_maxBufferedFrames(sampleRate),
+    m_onInputEvent(this, &MixerProducer::OnInputEvent),
+    m_onDeadline(this, &MixerProducer::OnDeadline)
+{
+    InitializeCriticalSection(&m_critSec);
+}
+
+MixerProducer::~MixerProducer()
+{
+    DeleteCriticalSection(&m_critSec);
+}
+
+HRESULT MixerProducer::CreateFloatAudioType(DWORD sampleRate, DWORD channels, IMFMediaType** ppType)
+{
+    if (ppType == NULL)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+    winrt::com_ptr<IMFMediaType> type;
+    CHECK_HR(hr = MFCreateMediaType(type.put()));
+    CHECK_HR(hr = type->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio));
+    CHECK_HR(hr = type->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_Float));
+    CHECK_HR(hr = type->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, channels));
+    CHECK_HR(hr = type->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, sampleRate));
+    CHECK_HR(hr = type->SetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, 32));
+    CHECK_HR(hr = type->SetUINT32(MF_MT_AUDIO_BLOCK_ALIGNMENT, channels * (UINT32)sizeof(float)));
+    CHECK_HR(hr = type->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, sampleRate * channels * (UINT32)sizeof(float)));
+    CHECK_HR(hr = type->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE));
+    *ppType = type.detach();
+    return hr;
+}
+
+HRESULT MixerProducer::AddInput(MediaSource* pSource, float gain)
+{
+    if (pSource == NULL)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+    winrt::com_ptr<MediaStream> stream;
+    winrt::com_ptr<IMFMediaType> type;
+    GUID subtype = GUID_NULL;
+    CHECK_HR(hr = pSource->GetStreamByIndex(0, stream.put()));
+    CHECK_HR(hr = stream->GetMediaType(type.put()));
+    if (type == nullptr ||
+        FAILED(type->GetGUID(MF_MT_SUBTYPE, &subtype)) || subtype != MFAudioFormat_Float ||
+        MFGetAttributeUINT32(type.get(), MF_MT_AUDIO_NUM_CHANNELS, 0) != m_channels ||
+        MFGetAttributeUINT32(type.get(), MF_MT_AUDIO_SAMPLES_PER_SECOND, 0) != m_sampleRate)
+    {
+        return MF_E_INVALIDMEDIATYPE;
+    }
+
+    Input input;
+    input.source.copy_from(pSource);
+    input.stream = stream.as<IMFMediaStream>();
+    input.gain = gain;
+
+    EnterCriticalSection(&m_critSec);
+    if (m_shutdown)
+    {
+        LeaveCriticalSection(&m_critSec);
+        return MF_E_SHUTDOWN;
+    }
+    m_inputs.push_back(input);
+    LeaveCriticalSection(&m_critSec);
+
+    // The stream itself is the callback state, to tell inputs apart.
+    CHECK_HR(hr = input.stream->BeginGetEvent(&m_onInputEvent, input.stream.get()));
+
+    winrt::com_ptr<IMFPresentationDescriptor> pd;
+    PROPVARIANT varStart;
+    PropVariantInit(&varStart);
+    CHECK_HR(hr = pSource->CreatePresentationDescriptor(pd.put()));
+    CHECK_HR(hr = pSource->Start(pd.get(), NULL, &varStart));
+    return hr;
+}
+
+HRESULT MixerProducer::SetGain(size_t input, float gain)
+{
+    HRESULT hr = S_OK;
+    EnterCriticalSection(&m_critSec);
+    if (input < m_inputs.size())
+    {
+        m_inputs[input].gain = gain;
+    }
+    else
+    {
+        hr = E_INVALIDARG;
+    }
+    LeaveCriticalSection(&m_critSec);
+    return hr;
+}
+
+void MixerProducer::GetStats(MixerStats* pStats)
+{
+    EnterCriticalSection(&m_critSec);
+    *pStats = m_stats;
+    LeaveCriticalSection(&m_critSec);
+}
+
+HRESULT MixerProducer::GetMediaType(DWORD /*streamIndex*/, IMFMediaType** ppType)
+{
+    return CreateFloatAudioType(m_sampleRate, m_channels, ppType);
+}
+
+DWORD MixerProducer::GetMaxSampleSize(DWORD /*streamIndex*/)
+{
+    return m_blockFrames * m_channels * (DWORD)sizeof(float);
+}
+
+HRESULT MixerProducer::ReadSample(DWORD streamIndex, SamplePool* pPool, IMFSample** ppSample)
+{
+    if (streamIndex != 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    bool scheduleDeadline = false;
+    EnterCriticalSection(&m_critSec);
+    HRESULT hr = MixBlock(pPool, ppSample, &scheduleDeadline);
+    LeaveCriticalSection(&m_critSec);
+
+    if (scheduleDeadline)
+    {
+        // Ask again at the deadline even if no more input arrives.
+        MFWORKITEM_KEY key;
+        LONGLONG milliseconds = m_deadline / 10000;
+        (void)MFScheduleWorkItem(&m_onDeadline, NULL, -(milliseconds > 0 ? milliseconds : 1), &key);
+    }
+    return hr;
+}
+
+void MixerProducer::SetDataReadyCallback(DWORD /*streamIndex*/, DataReadyCallback callback)
+{
+    EnterCriticalSection(&m_critSec);
+    m_onDataReady = callback;
+    LeaveCriticalSection(&m_critSec);
+}
+
+HRESULT MixerProducer::Shutdown()
+{
+    std::vector<Input> inputs;
+    EnterCriticalSection(&m_critSec);
+    if (!m_shutdown)
+    {
+        m_shutdown = true;
+        inputs.swap(m_inputs);
+        m_onDataReady = nullptr;
+    }
+    LeaveCriticalSection(&m_critSec);
+
+    // Shutting a child down also ends its event queue, which drops the
+    // reference it holds on this mixer through the pending callback.
+    for (auto& input : inputs)
+    {
+        (void)input.source->Shutdown();
+    }
+    return S_OK;
+}
+
+HRESULT MixerProducer::OnInputEvent(IMFAsyncResult* pResult)
+{
+    HRESULT hr = S_OK;
+    HRESULT hrStatus = S_OK;
+    MediaEventType type = MEUnknown;
+    winrt::com_ptr<IUnknown> state;
+    winrt::com_ptr<IMFMediaEvent> event;
+
+    CHECK_HR(hr = pResult->GetState(state.put()));
+    auto stream = state.try_as<IMFMediaStream>();
+    if (stream == nullptr)
+    {
+        return E_UNEXPECTED;
+    }
+    hr = stream->EndGetEvent(pResult, event.put());
+    if (SUCCEEDED(hr))
+    {
+        (void)event->GetType(&type);
+        (void)event->GetStatus(&hrStatus);
+    }
+
+    bool listen = SUCCEEDED(hr) && SUCCEEDED(hrStatus) && type != MEEndOfStream;
+    bool notify = false;
+    DWORD requests = 0;
+
+    EnterCriticalSection(&m_critSec);
+    Input* input = nullptr;
+    for (auto& candidate : m_inputs)
+    {
+        if (candidate.stream.get() == stream.get())
+        {
+            input = &candidate;
+            break;
+        }
+    }
+
+    if (input == nullptr)
+    {
+        // Removed by Shutdown.
+        listen = false;
+    }
+    else if (!listen)
+    {
+        // Ended or failed; from now on the input is silence.
+        input->ended = true;
+        notify = true;
+    }
+    else if (type == MEStreamStarted)
+    {
+        requests = MIXER_INPUT_REQUESTS;
+    }
+    else if (type == MEMediaSample)
+    {
+        PROPVARIANT var;
+        PropVariantInit(&var);
+        if (SUCCEEDED(event->GetValue(&var)) && var.vt == VT_UNKNOWN && var.punkVal != NULL)
+        {
+            winrt::com_ptr<IMFSample> sample;
+            if (SUCCEEDED(var.punkVal->QueryInterface(IID_PPV_ARGS(sample.put()))))
+            {
+                // Wake the output when this input first reaches into the
+                // pending block, which starts its deadline, and when it
+                // completes the block.
+                LONGLONG blockEnd = m_outFrame + m_blockFrames;
+                LONGLONG endBefore = input->EndFrame(m_channels);
+                (void)AppendInput(*input, sample.get());
+                LONGLONG endAfter = input->EndFrame(m_channels);
+                notify = !m_timelineStarted ||
+                    (endBefore <= m_outFrame && endAfter > m_outFrame) ||
+                    (endBefore < blockEnd && endAfter >= blockEnd);
+            }
+        }
+        PropVariantClear(&var);
+        requests = 1;
+    }
+    LeaveCriticalSection(&m_critSec);
+
+    for (DWORD i = 0; i < requests; i++)
+    {
+        (void)stream->RequestSample(NULL);
+    }
+    if (listen)
+    {
+        (void)stream->BeginGetEvent(&m_onInputEvent, stream.get());
+    }
+    if (notify)
+    {
+        NotifyDataReady();
+    }
+    return S_OK;
+}
+
+HRESULT MixerProducer::OnDeadline(IMFAsyncResult* /*pResult*/)
+{
+    NotifyDataReady();
+    return S_OK;
+}
+
+void MixerProducer::NotifyDataReady()
+{
+    DataReadyCallback callback;
+    EnterCriticalSection(&m_critSec);
+    callback = m_onDataReady;
+    LeaveCriticalSection(&m_critSec);
+    if (callback)
+    {
+        callback();
+    }
+}
+
+// Called with m_critSec held.
+HRESULT MixerProducer::AppendInput(Input& input, IMFSample* pSample)
+{
+    HRESULT hr = S_OK;
+    LONGLONG time = 0;
+    winrt::com_ptr<IMFMediaBuffer> buffer;
+    BYTE* data = nullptr;
+    DWORD length = 0;
+
+    CHECK_HR(hr = pSample->GetSampleTime(&time));
+    CHECK_HR(hr = SampleSlices::GetContiguousBuffer(pSample, buffer.put()));
+    CHECK_HR(hr = buffer->Lock(&data, NULL, &length));
+
+    const float* src = (const float*)data;
+    LONGLONG frames = length / (sizeof(float) * m_channels);
+    LONGLONG frame = (time * m_sampleRate + 5000000) / 10000000;
+
+    // Frames the output has already passed are dropped.
+    LONGLONG skip = 0;
+    if (m_timelineStarted && frame < m_outFrame)
+    {
+        skip = (std::min)(frames, m_outFrame - frame);
+        m_stats.framesDropped += skip;
+    }
+
+    if (input.BufferedFrames(m_channels) == 0)
+    {
+        input.samples.clear();
+        input.readOffset = 0;
+        input.startFrame = frame + skip;
+    }
+    else
+    {
+        LONGLONG end = input.EndFrame(m_channels);
+        if (frame + skip > end)
+        {
+            // A gap in the input is silence; a long one restarts the buffer.
+            LONGLONG gap = frame + skip - end;
+            if (gap > m_maxBufferedFrames)
+            {
+                input.samples.clear();
+                input.readOffset = 0;
+                input.startFrame = frame + skip;
+            }
+            else
+            {
+                input.samples.insert(input.samples.end(), (size_t)(gap * m_channels), 0.0f);
+            }
+        }
+        else if (frame + skip < end)
+        {
+            // Overlap with what is already buffered: keep the earlier data.
+            skip = (std::min)(frames, end - frame);
+        }
+    }
+
+    input.samples.insert(input.samples.end(), src + skip * m_channels, src + frames * m_channels);
+    (void)buffer->Unlock();
+
+    // Bound the backlog while the output is not being pulled.
+    if (input.BufferedFrames(m_channels) > m_maxBufferedFrames)
+    {
+        ConsumeInput(input, input.EndFrame(m_channels) - m_maxBufferedFrames);
+    }
+    return hr;
+}
+
+// Called with m_critSec held.
+void MixerProducer::ConsumeInput(Input& input, LONGLONG toFrame)
+{
+    LONGLONG frames = (std::min)(input.BufferedFrames(m_channels), toFrame - input.startFrame);
+    if (frames > 0)
+    {
+        input.readOffset += (size_t)(frames * m_channels);
+        input.startFrame += frames;
+    }
+    if (input.readOffset > 0 && input.readOffset * 2 >= input.samples.size())
+    {
+        input.samples.erase(input.samples.begin(), input.samples.begin() + input.readOffset);
+        input.readOffset = 0;
+    }
+}
+
+// Called with m_critSec held.
+HRESULT MixerProducer::MixBlock(SamplePool* pPool, IMFSample** ppSample, bool* pScheduleDeadline)
+{
+    if (m_shutdown)
+    {
+        return MF_E_SHUTDOWN;
+    }
+
+    HRESULT hr = S_OK;
+    bool allEnded = true;
+    bool anyData = false;
+
+    // The timeline starts at the earliest input.
+    if (!m_timelineStarted)
+    {
+        for (auto& input : m_inputs)
+        {
+            allEnded = allEnded && input.ended;
+            if (input.BufferedFrames(m_channels) > 0 && (!anyData || input.startFrame < m_outFrame))
+            {
+                m_outFrame = input.startFrame;
+                anyData = true;
+            }
+        }
+        if (!anyData)
+        {
+            return allEnded && !m_inputs.empty() ? MF_E_END_OF_STREAM : E_PENDING;
+        }
+        m_timelineStarted = true;
+        allEnded = true;
+        anyData = false;
+    }
+
+    LONGLONG blockEnd = m_outFrame + m_blockFrames;
+    DWORD missing = 0;
+    for (auto& input : m_inputs)
+    {
+        allEnded = allEnded && input.ended;
+        if (input.BufferedFrames(m_channels) > 0 && input.EndFrame(m_channels) > m_outFrame)
+        {
+            anyData = true;
+        }
+        if (!input.ended && input.EndFrame(m_channels) < blockEnd)
+        {
+            missing++;
+        }
+    }
+    if (allEnded && !anyData)
+    {
+        return MF_E_END_OF_STREAM;
+    }
+
+    if (missing > 0)
+    {
+        // Nothing at all for this block yet; the first arrival wakes us.
+        if (!anyData)
+        {
+            return E_PENDING;
+        }
+        LONGLONG now = OpTrace::Now();
+        if (m_waitStart == 0)
+        {
+            m_waitStart = now;
+            *pScheduleDeadline = true;
+        }
+        if (now - m_waitStart < m_deadline)
+        {
+            return E_PENDING;
+        }
+        m_stats.blocksLate++;
+        m_stats.inputsMissed += missing;
+    }
+
+    winrt::com_ptr<IMFSample> sample;
+    winrt::com_ptr<IMFMediaBuffer> buffer;
+    BYTE* data = nullptr;
+    CHECK_HR(hr = pPool->AcquireSample(sample.put()));
+    CHECK_HR(hr = sample->GetBufferByIndex(0, buffer.put()));
+    CHECK_HR(hr = buffer->Lock(&data, NULL, NULL));
+
+    float* out = (float*)data;
+    size_t count = (size_t)m_blockFrames * m_channels;
+    memset(out, 0, count * sizeof(float));
+    for (auto& input : m_inputs)
+    {
+        LONGLONG from = (std::max)(input.startFrame, m_outFrame);
+        LONGLONG to = (std::min)(input.EndFrame(m_channels), blockEnd);
+        if (to > from)
+        {
+            MixKernels::Mix(out + (from - m_outFrame) * m_channels,
+                input.samples.data() + input.readOffset + (from - input.startFrame) * m_channels,
+                input.gain, (size_t)((to - from) * m_channels));
+        }
+        ConsumeInput(input, blockEnd);
+    }
+    (void)buffer->Unlock();
+
+    // Times come from frame positions so rounding does not accumulate.
+    LONGLONG time = m_outFrame * 10000000 / m_sampleRate;
+    LONGLONG endTime = blockEnd * 10000000 / m_sampleRate;
+    CHECK_HR(hr = buffer->SetCurrentLength((DWORD)(count * sizeof(float))));
+    CHECK_HR(hr = sample->SetSampleTime(time));
+    CHECK_HR(hr = sample->SetSampleDuration(endTime - time));
+    CHECK_HR(hr = sample->SetUINT32(MFSampleExtension_CleanPoint, TRUE));
+
+    m_outFrame = blockEnd;
+    m_waitStart = 0;
+    m_stats.blocksMixed++;
+    *ppSample = sample.detach();
+    return hr;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <vector>
+#include "MediaSource.h"
+#include "AsyncCallback.h"
+
+struct MixerStats
+{
+    LONGLONG blocksMixed;
+    LONGLONG blocksLate;        // Mixed at the deadline with inputs missing.
+    LONGLONG inputsMissed;      // Input slots filled with silence at the deadline.
+    LONGLONG framesDropped;     // Input frames that arrived after their block was mixed.
+};
+
+// Producer for a composite source that mixes the audio streams of N child
+// MediaSources into one. The mixer is an ordinary consumer of each child's
+// first stream: it starts the child, keeps sample requests outstanding and
+// collects MEMediaSample events. Inputs are aligned on their timestamps and
+// summed block by block into pooled output buffers. A block is mixed as soon
+// as every input covers it, or once the deadline has passed since the first
+// input did; whatever is still missing is treated as silence.
+//
+// All inputs and the output are interleaved float PCM at the mixer's rate
+// and channel count. Child sources are shut down with the mixer. Use it as
+// the producer of a MediaSource:
+//     auto mixer = winrt::make_self<MixerProducer>(48000, 2, 480, 200000);
+//     mixer->AddInput(child.get(), 1.0f);
+//     source->SetProducer(mixer.get());
+//     source->Initialize();
+class MixerProducer : public SampleProducer
+{
+public:
+    MixerProducer(DWORD sampleRate, DWORD channels, DWORD blockFrames, LONGLONG deadline);
+    ~MixerProducer();
+
+    static HRESULT CreateFloatAudioType(DWORD sampleRate, DWORD channels, IMFMediaType** ppType);
+
+    // pSource must be initialized and have a float PCM first stream in the
+    // mixer's format. The mixer starts it.
+    HRESULT AddInput(MediaSource* pSource, float gain);
+    HRESULT SetGain(size_t input, float gain);
+    void GetStats(MixerStats* pStats);
+
+    // SampleProducer
+    DWORD GetStreamCount() { return 1; }
+    HRESULT GetMediaType(DWORD streamIndex, IMFMediaType** ppType);
+    DWORD GetMaxSampleSize(DWORD streamIndex);
+    HRESULT ReadSample(DWORD streamIndex, SamplePool* pPool, IMFSample** ppSample);
+    void SetDataReadyCallback(DWORD streamIndex, DataReadyCallback callback);
+    HRESULT Shutdown();
+
+protected:
+    HRESULT OnInputEvent(IMFAsyncResult* pResult);
+    HRESULT OnDeadline(IMFAsyncResult* pResult);
+
+private:
+    struct Input
+    {
+        winrt::com_ptr<MediaSource> source;
+        winrt::com_ptr<IMFMediaStream> stream;
+        float gain = 1.0f;
+        std::vector<float> samples;     // Interleaved; frames before readOffset are consumed.
+        size_t readOffset = 0;
+        LONGLONG startFrame = 0;        // Frame index of samples[readOffset].
+        bool ended = false;
+
+        LONGLONG BufferedFrames(DWORD channels) const { return (LONGLONG)(samples.size() - readOffset) / channels; }
+        LONGLONG EndFrame(DWORD channels) const { return startFrame + BufferedFrames(channels); }
+    };
+
+    HRESULT AppendInput(Input& input, IMFSample* pSample);
+    void ConsumeInput(Input& input, LONGLONG toFrame);
+    HRESULT MixBlock(SamplePool* pPool, IMFSample** ppSample, bool* pScheduleDeadline);
+    void NotifyDataReady();
+
+    CRITICAL_SECTION m_critSec;
+    DWORD m_sampleRate;
+    DWORD m_channels;
+    DWORD m_blockFrames;
+    LONGLONG m_deadline;
+    LONGLONG m_maxBufferedFrames;
+
+    std::vector<Input> m_inputs;
+    bool m_timelineStarted = false;
+    LONGLONG m_outFrame = 0;        // First frame of the next output block.
+    LONGLONG m_waitStart = 0;       // When the next block first had any input.
+    bool m_shutdown = false;
+    MixerStats m_stats = {};
+
+    DataReadyCallback m_onDataReady;
+    AsyncCallback<MixerProducer> m_onInputEvent;
+    AsyncCallback<MixerProducer> m_onDeadline;
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include "AsyncCallback.h"
+#include <Mferror.h>
 #include <list>
 #include <functional>
 
@@ -9,38 +10,76 @@ class OpQueue : public winrt::implements<OpQueue<OP_TYPE>,IUnknown>
 public:
     typedef std::list<OP_TYPE*> OperationList;
 
-    OpQueue(CRITICAL_SECTION& critsec
+    OpQueue(SourceLock* pLock
         , std::function<HRESULT(OP_TYPE*)> validateOperation
-        , std::function<HRESULT(OP_TYPE*)> dispatchOperation)
+        , std::function<HRESULT(OP_TYPE*)> dispatchOperation
+        , DWORD workQueue = MFASYNC_CALLBACK_QUEUE_STANDARD)
         : m_OnProcessQueue(this, &OpQueue::ProcessQueueAsync),
-        m_critsec(critsec)
+        m_workQueue(workQueue)
     {
+        m_lock.copy_from(pLock);
         m_validateOperation = validateOperation;
         m_dispatchOperation = dispatchOperation;
     }
 
     ~OpQueue() = default;
 
+    // Drop pending ops and detach from the owner. Work items that are
+    // already queued become no-ops.
+    void Shutdown()
+    {
+        EnterCriticalSection(&m_lock->Get());
+        for (OP_TYPE* pOp : m_OpQueue)
+        {
+            pOp->Release();
+        }
+        m_OpQueue.clear();
+        m_validateOperation = nullptr;
+        m_dispatchOperation = nullptr;
+        LeaveCriticalSection(&m_lock->Get());
+    }
+
     HRESULT QueueOperation(OP_TYPE* pOp)
     {
         HRESULT hr = S_OK;
-        EnterCriticalSection(&m_critsec);
+        EnterCriticalSection(&m_lock->Get());
+        if (!m_dispatchOperation)
+        {
+            LeaveCriticalSection(&m_lock->Get());
+            return MF_E_SHUTDOWN;
+        }
         m_OpQueue.push_back(pOp);
         pOp->AddRef();
         if (SUCCEEDED(hr))
         {
             hr = ProcessQueue();
         }
-        LeaveCriticalSection(&m_critsec);
+        LeaveCriticalSection(&m_lock->Get());
         return hr;
     }
 
+    // Work items queued from now on run on workQueue.
+    void SetWorkQueue(DWORD workQueue)
+    {
+        EnterCriticalSection(&m_lock->Get());
+        m_workQueue = workQueue;
+        LeaveCriticalSection(&m_lock->Get());
+    }
+
+    bool IsEmpty()
+    {
+        EnterCriticalSection(&m_lock->Get());
+        bool empty = m_OpQueue.empty();
+        LeaveCriticalSection(&m_lock->Get());
+        return empty;
+    }
+
     HRESULT ProcessQueue()
     {
         HRESULT hr = S_OK;
         if (m_OpQueue.size() > 0)
         {
-            hr = MFPutWorkItem(MFASYNC_CALLBACK_QUEUE_STANDARD, &m_OnProcessQueue, NULL);
+            hr = MFPutWorkItem(m_workQueue, &m_OnProcessQueue, NULL);
         }
         return hr;
     }
@@ -50,9 +89,9 @@ protected:
         HRESULT hr = S_OK;
         OP_TYPE* pOp = NULL;
 
-        EnterCriticalSection(&m_critsec);
+        EnterCriticalSection(&m_lock->Get());
 
-        if (m_OpQueue.size() > 0)
+        if (m_OpQueue.size() > 0 && m_dispatchOperation)
         {
             pOp = m_OpQueue.front();
 
@@ -61,18 +100,20 @@ protected:
             if (SUCCEEDED(hr))
             {
                 m_OpQueue.pop_front();
-                pOp->Release();
                 (void)m_dispatchOperation(pOp);
+                pOp->Release();
             }
         }
-        LeaveCriticalSection(&m_critsec);
+        LeaveCriticalSection(&m_lock->Get());
         return hr;
     }
 
 protected:
     OperationList m_OpQueue;
-    CRITICAL_SECTION& m_critsec;         // Protects the queue state.
+    winrt::com_ptr<SourceLock> m_lock;   // Protects the queue state; shared with the owner, which
+                                         // queued work items can outlive.
     AsyncCallback<OpQueue>  m_OnProcessQueue;  // ProcessQueueAsync callback.
+    DWORD m_workQueue;                   // MF work queue the callback runs on.
 
     std::function<HRESULT(OP_TYPE*)> m_dispatchOperation;
     std::function<HRESULT(OP_TYPE*)> m_validateOperation;
@@ -0,0 +1,280 @@
+#include "pch.h"
+#include "OpTrace.h"
+#include "SourceOp.h"
+#include <Mferror.h>
+#include <algorithm>
+#include <map>
+#include <queue>
+
+const size_t TRACE_BUFFER_RECORDS = 4096;
+
+CRITICAL_SECTION OpTrace::s_critSec;
+HANDLE OpTrace::s_file = INVALID_HANDLE_VALUE;
+std::vector<TraceRecord> OpTrace::s_buffer;
+volatile bool OpTrace::s_recording = false;
+volatile bool OpTrace::s_virtualClock = false;
+volatile LONGLONG OpTrace::s_virtualTime = 0;
+LONGLONG OpTrace::s_serviceTime[256] = {};
+std::map<uint32_t, LONGLONG> OpTrace::s_busyUntil;
+
+static INIT_ONCE s_traceInit = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK InitTraceLock(PINIT_ONCE, PVOID pCritSec, PVOID*)
+{
+    InitializeCriticalSection((CRITICAL_SECTION*)pCritSec);
+    return TRUE;
+}
+
+HRESULT OpTrace::Start(LPCWSTR path)
+{
+    if (path == NULL)
+    {
+        return E_POINTER;
+    }
+    InitOnceExecuteOnce(&s_traceInit, InitTraceLock, &s_critSec, NULL);
+
+    EnterCriticalSection(&s_critSec);
+    if (s_file != INVALID_HANDLE_VALUE)
+    {
+        LeaveCriticalSection(&s_critSec);
+        return MF_E_INVALIDREQUEST;
+    }
+
+    HANDLE file = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        LeaveCriticalSection(&s_critSec);
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    TraceHeader header = { TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord) };
+    DWORD written = 0;
+    if (!WriteFile(file, &header, sizeof(header), &written, NULL))
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        CloseHandle(file);
+        LeaveCriticalSection(&s_critSec);
+        return hr;
+    }
+
+    s_file = file;
+    s_buffer.reserve(TRACE_BUFFER_RECORDS);
+    s_recording = true;
+    LeaveCriticalSection(&s_critSec);
+    return S_OK;
+}
+
+HRESULT OpTrace::Stop()
+{
+    InitOnceExecuteOnce(&s_traceInit, InitTraceLock, &s_critSec, NULL);
+
+    EnterCriticalSection(&s_critSec);
+    s_recording = false;
+    HRESULT hr = Flush();
+    if (s_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(s_file);
+        s_file = INVALID_HANDLE_VALUE;
+    }
+    LeaveCriticalSection(&s_critSec);
+    return hr;
+}
+
+void OpTrace::UseVirtualClock(bool bVirtual)
+{
+    InitOnceExecuteOnce(&s_traceInit, InitTraceLock, &s_critSec, NULL);
+
+    EnterCriticalSection(&s_critSec);
+    s_virtualClock = bVirtual;
+    s_busyUntil.clear();
+    LeaveCriticalSection(&s_critSec);
+}
+
+LONGLONG OpTrace::Now()
+{
+    if (s_virtualClock)
+    {
+        return s_virtualTime;
+    }
+
+    static LARGE_INTEGER frequency = {};
+    if (frequency.QuadPart == 0)
+    {
+        QueryPerformanceFrequency(&frequency);
+    }
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    // Split the conversion to avoid overflowing on long uptimes.
+    LONGLONG seconds = counter.QuadPart / frequency.QuadPart;
+    LONGLONG remainder = counter.QuadPart % frequency.QuadPart;
+    return seconds * 10000000 + remainder * 10000000 / frequency.QuadPart;
+}
+
+void OpTrace::Record(TraceEvent kind, uint32_t source, uint16_t stream, uint8_t op, LONGLONG aux)
+{
+    if (!s_recording)
+    {
+        return;
+    }
+
+    TraceRecord record = { (uint8_t)kind, op, stream, source, Now(), aux };
+
+    EnterCriticalSection(&s_critSec);
+    if (s_virtualClock && kind == TraceEvent::OP_DISPATCH)
+    {
+        // Whatever the op records until the next input is stamped with the
+        // time it finishes.
+        LONGLONG& busyUntil = s_busyUntil[source];
+        record.time = (std::max)(record.time, busyUntil);
+        busyUntil = record.time + s_serviceTime[op];
+        s_virtualTime = busyUntil;
+    }
+    if (s_recording)
+    {
+        s_buffer.push_back(record);
+        if (s_buffer.size() >= TRACE_BUFFER_RECORDS)
+        {
+            (void)Flush();
+        }
+    }
+    LeaveCriticalSection(&s_critSec);
+}
+
+// Called with s_critSec held.
+HRESULT OpTrace::Flush()
+{
+    HRESULT hr = S_OK;
+    if (s_file != INVALID_HANDLE_VALUE && !s_buffer.empty())
+    {
+        DWORD size = (DWORD)(s_buffer.size() * sizeof(TraceRecord));
+        DWORD written = 0;
+        if (!WriteFile(s_file, s_buffer.data(), size, &written, NULL))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+    s_buffer.clear();
+    return hr;
+}
+
+HRESULT OpTrace::Load(LPCWSTR path, std::vector<TraceRecord>& records)
+{
+    if (path == NULL)
+    {
+        return E_POINTER;
+    }
+
+    HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    HRESULT hr = S_OK;
+    TraceHeader header = {};
+    DWORD read = 0;
+    if (!ReadFile(file, &header, sizeof(header), &read, NULL) || read != sizeof(header))
+    {
+        hr = MF_E_INVALID_FILE_FORMAT;
+    }
+    else if (header.magic != TRACE_MAGIC || header.version < 1 || header.version > TRACE_VERSION ||
+        header.recordSize != sizeof(TraceRecord))
+    {
+        hr = MF_E_INVALID_FILE_FORMAT;
+    }
+
+    records.clear();
+    TraceRecord chunk[256];
+    while (SUCCEEDED(hr))
+    {
+        if (!ReadFile(file, chunk, sizeof(chunk), &read, NULL))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            break;
+        }
+        if (read == 0)
+        {
+            break;
+        }
+        records.insert(records.end(), chunk, chunk + read / sizeof(TraceRecord));
+    }
+
+    // Version 1 traces did not record op arguments. Their starts replay at
+    // the current position and their rate changes are skipped.
+    if (SUCCEEDED(hr) && header.version == 1)
+    {
+        for (TraceRecord& record : records)
+        {
+            if ((TraceEvent)record.kind == TraceEvent::OP_ENQUEUE &&
+                ((Operation)record.op == Operation::OP_START || (Operation)record.op == Operation::OP_SET_RATE))
+            {
+                record.aux = TRACE_NO_VALUE;
+            }
+        }
+    }
+
+    CloseHandle(file);
+    return hr;
+}
+
+static void ComputeLatency(std::vector<LONGLONG>& samples, LatencyStats* pStats)
+{
+    *pStats = LatencyStats();
+    if (samples.empty())
+    {
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    pStats->count = samples.size();
+    pStats->p50 = samples[samples.size() * 50 / 100];
+    pStats->p90 = samples[samples.size() * 90 / 100];
+    pStats->p99 = samples[samples.size() * 99 / 100];
+    pStats->max = samples.back();
+}
+
+HRESULT TraceStats::Compute(const std::vector<TraceRecord>& records, TraceStats* pStats)
+{
+    if (pStats == NULL)
+    {
+        return E_POINTER;
+    }
+
+    std::vector<LONGLONG> opLatency;
+    std::vector<LONGLONG> sampleLatency;
+    std::map<uint64_t, std::queue<LONGLONG>> pendingRequests;
+
+    for (const TraceRecord& record : records)
+    {
+        uint64_t key = ((uint64_t)record.source << 16) | record.stream;
+        switch ((TraceEvent)record.kind)
+        {
+        case TraceEvent::OP_DISPATCH:
+            // Ops queued before recording started have no enqueue time.
+            if (record.aux != 0)
+            {
+                opLatency.push_back(record.time - record.aux);
+            }
+            break;
+        case TraceEvent::SAMPLE_REQUEST:
+            pendingRequests[key].push(record.time);
+            break;
+        case TraceEvent::SAMPLE_DELIVERY:
+        {
+            auto& pending = pendingRequests[key];
+            if (!pending.empty())
+            {
+                sampleLatency.push_back(record.time - pending.front());
+                pending.pop();
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    ComputeLatency(opLatency, &pStats->opLatency);
+    ComputeLatency(sampleLatency, &pStats->sampleLatency);
+    return S_OK;
+}
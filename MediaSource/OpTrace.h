@@ -0,0 +1,112 @@
+#pragma once
+#include <mfidl.h>
+#include <map>
+#include <vector>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+
+// Kinds of record written to the trace log.
+enum class TraceEvent : uint8_t
+{
+    OP_ENQUEUE,         // Operation queued on the source's OpQueue; aux holds its arguments, see below.
+    OP_DISPATCH,        // Operation dispatched; aux holds the enqueue time.
+    SAMPLE_REQUEST,     // IMFMediaStream::RequestSample called.
+    SAMPLE_ARRIVAL,     // Producer pushed a sample onto the stream; aux holds the sample time.
+    SAMPLE_DELIVERY     // MEMediaSample queued; aux holds the sample time.
+};
+
+#pragma pack(push, 1)
+struct TraceRecord
+{
+    uint8_t  kind;      // TraceEvent
+    uint8_t  op;        // Operation, for op records.
+    uint16_t stream;    // Stream index, for sample records.
+    uint32_t source;    // Source id.
+    LONGLONG time;      // Trace clock, in 100ns units.
+    LONGLONG aux;
+};
+
+struct TraceHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+};
+#pragma pack(pop)
+
+const uint32_t TRACE_MAGIC = 0x5254534D; // 'MSTR'
+const uint16_t TRACE_VERSION = 2;          // 1 had no OP_ENQUEUE arguments.
+
+// OP_ENQUEUE aux: the stream count for OP_OPEN, the start position for
+// OP_START (TRACE_NO_VALUE for the current position) and the packed rate for
+// OP_SET_RATE (TRACE_NO_VALUE if unknown). Zero for the other ops.
+const LONGLONG TRACE_NO_VALUE = LLONG_MIN;
+
+inline LONGLONG PackTraceRate(float rate, bool thin)
+{
+    uint32_t bits = 0;
+    memcpy(&bits, &rate, sizeof(bits));
+    return (LONGLONG)bits | (thin ? 1LL << 32 : 0);
+}
+
+inline void UnpackTraceRate(LONGLONG aux, float* pRate, bool* pThin)
+{
+    uint32_t bits = (uint32_t)aux;
+    memcpy(pRate, &bits, sizeof(bits));
+    *pThin = (aux & (1LL << 32)) != 0;
+}
+
+// Process-wide recorder for op and sample timing. Recording is off until
+// Start is called; every hook is a single flag test while it is off.
+class OpTrace
+{
+public:
+    static HRESULT Start(LPCWSTR path);
+    static HRESULT Stop();
+    static bool IsRecording() { return s_recording; }
+
+    // The trace clock reads QueryPerformanceCounter unless a virtual clock is
+    // selected, in which case it returns whatever the replayer last set.
+    static LONGLONG Now();
+    static void UseVirtualClock(bool bVirtual);
+    static void SetVirtualTime(LONGLONG time) { s_virtualTime = time; }
+
+    // Under the virtual clock a dispatched op starts once its source has
+    // finished the previous one and then runs for its kind's service time.
+    static void SetServiceTime(uint8_t op, LONGLONG time) { s_serviceTime[op] = time; }
+
+    static void Record(TraceEvent kind, uint32_t source, uint16_t stream, uint8_t op, LONGLONG aux);
+
+    static HRESULT Load(LPCWSTR path, std::vector<TraceRecord>& records);
+
+private:
+    static HRESULT Flush();
+
+    static CRITICAL_SECTION s_critSec;
+    static HANDLE s_file;
+    static std::vector<TraceRecord> s_buffer;
+    static volatile bool s_recording;
+    static volatile bool s_virtualClock;
+    static volatile LONGLONG s_virtualTime;
+    static LONGLONG s_serviceTime[256];
+    static std::map<uint32_t, LONGLONG> s_busyUntil;    // Per source, under the virtual clock.
+};
+
+// Latency percentiles, in 100ns units.
+struct LatencyStats
+{
+    size_t count = 0;
+    LONGLONG p50 = 0;
+    LONGLONG p90 = 0;
+    LONGLONG p99 = 0;
+    LONGLONG max = 0;
+};
+
+struct TraceStats
+{
+    LatencyStats opLatency;         // OP_ENQUEUE to OP_DISPATCH, for ops queued while recording.
+    LatencyStats sampleLatency;     // SAMPLE_REQUEST to SAMPLE_DELIVERY, matched per stream in order.
+
+    static HRESULT Compute(const std::vector<TraceRecord>& records, TraceStats* pStats);
+};
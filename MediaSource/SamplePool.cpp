@@ -0,0 +1,133 @@
+#include "pch.h"
+#include "SamplePool.h"
+
+// Slab slices are kept cache-line aligned.
+const DWORD SLAB_ALIGNMENT = 64;
+// An empty pool grows by this many samples at once, sharing one slab.
+const DWORD POOL_GROW_BATCH = 8;
+
+SamplePool::SamplePool(DWORD bufferSize, DWORD numaNode)
+    : m_onSampleReleased(this, &SamplePool::OnSampleReleased),
+    m_bufferSize(bufferSize),
+    m_numaNode(numaNode)
+{
+    InitializeCriticalSection(&m_critSec);
+}
+
+SamplePool::~SamplePool()
+{
+    DeleteCriticalSection(&m_critSec);
+}
+
+HRESULT SamplePool::Prewarm(DWORD count)
+{
+    HRESULT hr = S_OK;
+    std::vector<winrt::com_ptr<IMFSample>> samples;
+    CHECK_HR(hr = CreateSamples(count, samples));
+
+    EnterCriticalSection(&m_critSec);
+    m_free.insert(m_free.end(), samples.begin(), samples.end());
+    LeaveCriticalSection(&m_critSec);
+    return hr;
+}
+
+HRESULT SamplePool::AcquireSample(IMFSample** ppSample)
+{
+    if (ppSample == NULL)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+    winrt::com_ptr<IMFSample> sample;
+
+    EnterCriticalSection(&m_critSec);
+    if (!m_free.empty())
+    {
+        sample = m_free.back();
+        m_free.pop_back();
+    }
+    LeaveCriticalSection(&m_critSec);
+
+    if (sample == nullptr)
+    {
+        std::vector<winrt::com_ptr<IMFSample>> samples;
+        CHECK_HR(hr = CreateSamples(POOL_GROW_BATCH, samples));
+        sample = samples.back();
+        samples.pop_back();
+
+        EnterCriticalSection(&m_critSec);
+        m_free.insert(m_free.end(), samples.begin(), samples.end());
+        LeaveCriticalSection(&m_critSec);
+    }
+
+    // The allocator has to be set again every time the sample is handed out.
+    CHECK_HR(hr = sample.as<IMFTrackedSample>()->SetAllocator(&m_onSampleReleased, NULL));
+    *ppSample = sample.detach();
+    return hr;
+}
+
+HRESULT SamplePool::CreateSamples(DWORD count, std::vector<winrt::com_ptr<IMFSample>>& samples)
+{
+    HRESULT hr = S_OK;
+    winrt::com_ptr<MemorySlab> slab;
+    DWORD stride = (m_bufferSize + SLAB_ALIGNMENT - 1) & ~(SLAB_ALIGNMENT - 1);
+
+    if (m_numaNode != NUMA_NO_PREFERRED_NODE)
+    {
+        CHECK_HR(hr = MemorySlab::Create((SIZE_T)stride * count, m_numaNode, slab.put()));
+    }
+
+    for (DWORD i = 0; i < count; i++)
+    {
+        winrt::com_ptr<IMFTrackedSample> tracked;
+        winrt::com_ptr<IMFMediaBuffer> buffer;
+
+        CHECK_HR(hr = MFCreateTrackedSample(tracked.put()));
+        if (slab != nullptr)
+        {
+            CHECK_HR(hr = SliceBuffer::Create(slab.as<IUnknown>().get(), slab->Data() + (SIZE_T)stride * i, m_bufferSize, 0, buffer.put()));
+        }
+        else
+        {
+            CHECK_HR(hr = MFCreateMemoryBuffer(m_bufferSize, buffer.put()));
+        }
+
+        auto sample = tracked.as<IMFSample>();
+        CHECK_HR(hr = sample->AddBuffer(buffer.get()));
+        samples.push_back(sample);
+    }
+    return hr;
+}
+
+HRESULT SamplePool::OnSampleReleased(IMFAsyncResult* pResult)
+{
+    HRESULT hr = S_OK;
+    winrt::com_ptr<IUnknown> object;
+    winrt::com_ptr<IMFSample> sample;
+    winrt::com_ptr<IMFMediaBuffer> buffer;
+
+    CHECK_HR(hr = pResult->GetObject(object.put()));
+    sample = object.as<IMFSample>();
+
+    // A sample whose buffer list was changed (slices appended, or made
+    // contiguous) no longer owns just its pool buffer; let it go.
+    DWORD bufferCount = 0;
+    CHECK_HR(hr = sample->GetBufferCount(&bufferCount));
+    if (bufferCount != 1)
+    {
+        return S_OK;
+    }
+
+    // Drop whatever the last user attached (token, clean point, times).
+    CHECK_HR(hr = sample->DeleteAllItems());
+    CHECK_HR(hr = sample->SetSampleTime(0));
+    CHECK_HR(hr = sample->SetSampleDuration(0));
+    CHECK_HR(hr = sample->GetBufferByIndex(0, buffer.put()));
+    CHECK_HR(hr = buffer->SetCurrentLength(0));
+
+    EnterCriticalSection(&m_critSec);
+    m_free.push_back(sample);
+    LeaveCriticalSection(&m_critSec);
+    return hr;
+}
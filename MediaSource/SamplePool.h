@@ -0,0 +1,34 @@
+#pragma once
+#include <mfapi.h>
+#include <vector>
+#include "AsyncCallback.h"
+#include "MemoryBuffer.h"
+
+// Fixed-size pool of tracked samples, each with one memory buffer. A sample
+// handed out by AcquireSample returns to the pool when its last reference is
+// released, so steady-state delivery does not allocate. An empty pool grows
+// by a batch rather than one sample at a time. With a NUMA node the buffers
+// are carved from slabs committed on that node, one slab per batch.
+class SamplePool : public winrt::implements<SamplePool, IUnknown>
+{
+public:
+    SamplePool(DWORD bufferSize, DWORD numaNode = NUMA_NO_PREFERRED_NODE);
+    ~SamplePool();
+
+    HRESULT Prewarm(DWORD count);
+    HRESULT AcquireSample(IMFSample** ppSample);
+
+    DWORD BufferSize() const { return m_bufferSize; }
+    DWORD NumaNode() const { return m_numaNode; }
+
+protected:
+    HRESULT CreateSamples(DWORD count, std::vector<winrt::com_ptr<IMFSample>>& samples);
+    HRESULT OnSampleReleased(IMFAsyncResult* pResult);
+
+private:
+    CRITICAL_SECTION m_critSec;
+    std::vector<winrt::com_ptr<IMFSample>> m_free;
+    AsyncCallback<SamplePool> m_onSampleReleased;
+    DWORD m_bufferSize;
+    DWORD m_numaNode;
+};
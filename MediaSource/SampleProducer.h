@@ -0,0 +1,40 @@
+#pragma once
+#include <mfidl.h>
+#include <functional>
+#include "SamplePool.h"
+
+typedef std::function<void()> DataReadyCallback;
+
+// Supplies stream formats and payloads to a MediaSource. ReadSample is called
+// on the source's OpQueue worker while handling OP_OPEN and OP_REQUEST_DATA.
+class SampleProducer : public winrt::implements<SampleProducer, IUnknown>
+{
+public:
+    virtual ~SampleProducer() = default;
+
+    virtual DWORD GetStreamCount() = 0;
+    virtual HRESULT GetMediaType(DWORD streamIndex, IMFMediaType** ppType) = 0;
+    virtual DWORD GetMaxSampleSize(DWORD streamIndex) = 0;
+
+    // Fill a sample taken from pPool. Returns MF_E_END_OF_STREAM once the
+    // stream has no more data, or E_PENDING while the next sample is still
+    // being read; the producer then calls the stream's data-ready callback
+    // when it can be asked again.
+    virtual HRESULT ReadSample(DWORD streamIndex, SamplePool* pPool, IMFSample** ppSample) = 0;
+
+    // Set by the stream when it opens. May be called from any thread.
+    virtual void SetDataReadyCallback(DWORD /*streamIndex*/, DataReadyCallback /*callback*/) {}
+
+    // The source is shutting down. Release anything that refers back to it.
+    virtual HRESULT Shutdown() { return S_OK; }
+
+    // Playback rate changed. When thin is set only sync samples will be
+    // delivered, so a producer with a keyframe index should skip reading
+    // everything else. The stream drops non-sync samples either way.
+    virtual HRESULT SetRate(DWORD /*streamIndex*/, float /*rate*/, bool /*thin*/) { return S_OK; }
+
+    // The stream was selected or deselected in the presentation. A live
+    // producer should resume a reselected stream at the live edge rather
+    // than where it left off.
+    virtual HRESULT SelectStream(DWORD /*streamIndex*/, bool /*selected*/) { return S_OK; }
+};
@@ -0,0 +1,110 @@
+#include "pch.h"
+#include "SampleSlices.h"
+
+volatile LONGLONG SampleSlices::s_bytesReferenced = 0;
+volatile LONGLONG SampleSlices::s_bytesCopied = 0;
+
+// Holds a media buffer locked for as long as slices point into it.
+class LockedBuffer : public winrt::implements<LockedBuffer, IUnknown>
+{
+public:
+    LockedBuffer(IMFMediaBuffer* pBuffer, BYTE* pData, DWORD length)
+        : m_data(pData), m_length(length)
+    {
+        m_buffer.copy_from(pBuffer);
+    }
+    ~LockedBuffer()
+    {
+        (void)m_buffer->Unlock();
+    }
+
+    BYTE* Data() const { return m_data; }
+    DWORD Length() const { return m_length; }
+
+private:
+    winrt::com_ptr<IMFMediaBuffer> m_buffer;
+    BYTE* m_data;
+    DWORD m_length;
+};
+
+HRESULT SampleSlices::AddSlice(IMFSample* pSample, IUnknown* pOwner, BYTE* pData, DWORD length)
+{
+    if (pSample == NULL)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+    winrt::com_ptr<IMFMediaBuffer> slice;
+    CHECK_HR(hr = SliceBuffer::Create(pOwner, pData, length, length, slice.put()));
+    CHECK_HR(hr = pSample->AddBuffer(slice.get()));
+    InterlockedAdd64(&s_bytesReferenced, length);
+    return hr;
+}
+
+HRESULT SampleSlices::AddBufferSlice(IMFSample* pSample, IMFMediaBuffer* pBuffer, DWORD offset, DWORD length)
+{
+    if (pSample == NULL || pBuffer == NULL)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+    winrt::com_ptr<IUnknown> owner;
+    BYTE* data = nullptr;
+    DWORD currentLength = 0;
+    CHECK_HR(hr = LockBuffer(pBuffer, owner.put(), &data, &currentLength));
+    if (offset > currentLength || length > currentLength - offset)
+    {
+        return E_INVALIDARG;
+    }
+    return AddSlice(pSample, owner.get(), data + offset, length);
+}
+
+HRESULT SampleSlices::LockBuffer(IMFMediaBuffer* pBuffer, IUnknown** ppOwner, BYTE** ppData, DWORD* pLength)
+{
+    if (pBuffer == NULL || ppOwner == NULL || ppData == NULL || pLength == NULL)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+    BYTE* data = nullptr;
+    DWORD currentLength = 0;
+    CHECK_HR(hr = pBuffer->Lock(&data, NULL, &currentLength));
+
+    // The lock is owned by LockedBuffer from here on.
+    auto locked = winrt::make_self<LockedBuffer>(pBuffer, data, currentLength);
+    locked.as<IUnknown>().copy_to(ppOwner);
+    *ppData = data;
+    *pLength = currentLength;
+    return hr;
+}
+
+HRESULT SampleSlices::GetContiguousBuffer(IMFSample* pSample, IMFMediaBuffer** ppBuffer)
+{
+    if (pSample == NULL || ppBuffer == NULL)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+    DWORD bufferCount = 0;
+    CHECK_HR(hr = pSample->GetBufferCount(&bufferCount));
+    if (bufferCount == 1)
+    {
+        return pSample->GetBufferByIndex(0, ppBuffer);
+    }
+
+    DWORD totalLength = 0;
+    CHECK_HR(hr = pSample->GetTotalLength(&totalLength));
+    CHECK_HR(hr = pSample->ConvertToContiguousBuffer(ppBuffer));
+    InterlockedAdd64(&s_bytesCopied, totalLength);
+    return hr;
+}
+
+void SampleSlices::GetCounters(SliceCounters* pCounters)
+{
+    pCounters->bytesReferenced = s_bytesReferenced;
+    pCounters->bytesCopied = s_bytesCopied;
+}
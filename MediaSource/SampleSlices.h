@@ -0,0 +1,42 @@
+#pragma once
+#include <mfapi.h>
+#include "MemoryBuffer.h"
+
+// UINT32 set on samples whose buffers other samples read as well, such as
+// slices of a cached chunk. Their payload must not be modified in place.
+// {69F4323D-B0ED-41D7-9DDC-1CF142952532}
+DEFINE_GUID(SampleExtension_SharedPayload, 0x69f4323d, 0xb0ed, 0x41d7, 0x9d, 0xdc, 0x1c, 0xf1, 0x42, 0x95, 0x25, 0x32);
+
+struct SliceCounters
+{
+    LONGLONG bytesReferenced;   // Payload attached to samples without copying.
+    LONGLONG bytesCopied;       // Payload copied to make a sample contiguous.
+};
+
+// Builds scatter-gather samples: one IMFSample whose buffers are, in order,
+// slices of pooled or mapped memory. A producer whose access unit spans
+// several reads attaches each read instead of concatenating them.
+class SampleSlices
+{
+public:
+    // Attach length bytes at pData, kept valid by pOwner.
+    static HRESULT AddSlice(IMFSample* pSample, IUnknown* pOwner, BYTE* pData, DWORD length);
+
+    // Attach a byte range of another buffer. The source buffer stays locked
+    // until every slice of it has been released.
+    static HRESULT AddBufferSlice(IMFSample* pSample, IMFMediaBuffer* pBuffer, DWORD offset, DWORD length);
+
+    // Lock a buffer once for many slices. ppOwner holds the lock; pass it to
+    // AddSlice with pointers into *ppData.
+    static HRESULT LockBuffer(IMFMediaBuffer* pBuffer, IUnknown** ppOwner, BYTE** ppData, DWORD* pLength);
+
+    // Return the sample's payload as one buffer. Copies only when the sample
+    // has more than one buffer.
+    static HRESULT GetContiguousBuffer(IMFSample* pSample, IMFMediaBuffer** ppBuffer);
+
+    static void GetCounters(SliceCounters* pCounters);
+
+private:
+    static volatile LONGLONG s_bytesReferenced;
+    static volatile LONGLONG s_bytesCopied;
+};
@@ -0,0 +1,228 @@
+#include "pch.h"
+#include "SourceHost.h"
+
+HRESULT SourceHost::Create(SourceHost** ppHost, PlacementPolicy policy)
+{
+    if (ppHost == NULL)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+    auto host = winrt::make_self<SourceHost>(policy);
+    CHECK_HR(hr = host->Initialize());
+    *ppHost = host.detach();
+    return hr;
+}
+
+SourceHost::SourceHost(PlacementPolicy policy)
+    : m_policy(policy),
+    m_onPinWorker(this, &SourceHost::OnPinWorker)
+{
+    InitializeCriticalSection(&m_critSec);
+}
+
+SourceHost::~SourceHost()
+{
+    if (m_workQueue != 0)
+    {
+        (void)MFUnlockWorkQueue(m_workQueue);
+    }
+    for (const Worker& worker : m_workers)
+    {
+        (void)MFUnlockWorkQueue(worker.workQueue);
+    }
+    if (m_pinned != NULL)
+    {
+        CloseHandle(m_pinned);
+    }
+    DeleteCriticalSection(&m_critSec);
+}
+
+HRESULT SourceHost::Initialize()
+{
+    HRESULT hr = S_OK;
+    if (m_policy == PlacementPolicy::SHARED)
+    {
+        return MFAllocateWorkQueueEx(MF_MULTITHREADED_WORKQUEUE, &m_workQueue);
+    }
+    CHECK_HR(hr = StartWorkers());
+    return hr;
+}
+
+HRESULT SourceHost::StartWorkers()
+{
+    HRESULT hr = S_OK;
+    DWORD length = 0;
+    (void)GetLogicalProcessorInformationEx(RelationNumaNode, NULL, &length);
+    std::vector<BYTE> info(length);
+    auto pInfo = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)info.data();
+    if (!GetLogicalProcessorInformationEx(RelationNumaNode, pInfo, &length))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // One worker per logical processor, ordered node by node.
+    for (DWORD offset = 0; offset < length; offset += pInfo->Size)
+    {
+        pInfo = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)(info.data() + offset);
+        const GROUP_AFFINITY& nodeMask = pInfo->NumaNode.GroupMask;
+        for (DWORD bit = 0; bit < sizeof(KAFFINITY) * 8; bit++)
+        {
+            KAFFINITY mask = (KAFFINITY)1 << bit;
+            if ((nodeMask.Mask & mask) == 0)
+            {
+                continue;
+            }
+            Worker worker = {};
+            worker.numaNode = (USHORT)pInfo->NumaNode.NodeNumber;
+            worker.affinity.Group = nodeMask.Group;
+            worker.affinity.Mask = mask;
+            CHECK_HR(hr = MFAllocateWorkQueueEx(MF_STANDARD_WORKQUEUE, &worker.workQueue));
+            m_workers.push_back(worker);
+        }
+    }
+    if (m_workers.empty())
+    {
+        return E_UNEXPECTED;
+    }
+
+    // A private standard work queue has exactly one thread for its lifetime,
+    // so pinning it once from inside a work item sticks.
+    m_pinned = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (m_pinned == NULL)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    for (size_t i = 0; i < m_workers.size(); i++)
+    {
+        m_pinWorker = i;
+        CHECK_HR(hr = MFPutWorkItem(m_workers[i].workQueue, &m_onPinWorker, NULL));
+        WaitForSingleObject(m_pinned, INFINITE);
+    }
+    return hr;
+}
+
+HRESULT SourceHost::OnPinWorker(IMFAsyncResult* /*pResult*/)
+{
+    SetThreadGroupAffinity(GetCurrentThread(), &m_workers[m_pinWorker].affinity, NULL);
+    SetEvent(m_pinned);
+    return S_OK;
+}
+
+HRESULT SourceHost::CreateSource(SampleProducer* pProducer, MediaSource** ppSource)
+{
+    if (m_policy == PlacementPolicy::SHARED)
+    {
+        return CreateSourceOnWorker(SIZE_MAX, pProducer, ppSource);
+    }
+    return CreateSourceOnWorker(NextWorker(), pProducer, ppSource);
+}
+
+HRESULT SourceHost::CreateSourceOnNode(USHORT numaNode, SampleProducer* pProducer, MediaSource** ppSource)
+{
+    if (m_policy == PlacementPolicy::SHARED)
+    {
+        return MF_E_INVALIDREQUEST;
+    }
+    size_t worker = NextWorkerOnNode(numaNode);
+    if (worker == SIZE_MAX)
+    {
+        return E_INVALIDARG;
+    }
+    return CreateSourceOnWorker(worker, pProducer, ppSource);
+}
+
+HRESULT SourceHost::CreateSourceOnProcessor(const PROCESSOR_NUMBER& processor, SampleProducer* pProducer, MediaSource** ppSource)
+{
+    if (m_policy == PlacementPolicy::SHARED)
+    {
+        return MF_E_INVALIDREQUEST;
+    }
+    for (size_t i = 0; i < m_workers.size(); i++)
+    {
+        const GROUP_AFFINITY& affinity = m_workers[i].affinity;
+        if (affinity.Group == processor.Group && affinity.Mask == ((KAFFINITY)1 << processor.Number))
+        {
+            return CreateSourceOnWorker(i, pProducer, ppSource);
+        }
+    }
+    return E_INVALIDARG;
+}
+
+// worker is SIZE_MAX for the shared work queue.
+HRESULT SourceHost::CreateSourceOnWorker(size_t worker, SampleProducer* pProducer, MediaSource** ppSource)
+{
+    if (ppSource == NULL)
+    {
+        return E_POINTER;
+    }
+
+    DWORD workQueue = worker == SIZE_MAX ? m_workQueue : m_workers[worker].workQueue;
+    winrt::com_ptr<MediaSource> source;
+    MediaSource::Create(source.put(), workQueue);
+    if (source == nullptr)
+    {
+        return E_OUTOFMEMORY;
+    }
+    if (worker != SIZE_MAX)
+    {
+        source->SetPlacement(workQueue, m_workers[worker].numaNode);
+    }
+    if (m_policy == PlacementPolicy::FOLLOW_CONSUMER)
+    {
+        source->SetConsumerCallback([this](MediaSource* pSource, const PROCESSOR_NUMBER& processor)
+            {
+                OnConsumer(pSource, processor);
+            });
+    }
+    source->SetProducer(pProducer);
+    source->Initialize();
+    *ppSource = source.detach();
+    return S_OK;
+}
+
+size_t SourceHost::NextWorker()
+{
+    EnterCriticalSection(&m_critSec);
+    size_t worker = m_nextWorker++ % m_workers.size();
+    LeaveCriticalSection(&m_critSec);
+    return worker;
+}
+
+size_t SourceHost::NextWorkerOnNode(USHORT numaNode)
+{
+    size_t worker = SIZE_MAX;
+    EnterCriticalSection(&m_critSec);
+    for (size_t i = 0; i < m_workers.size(); i++)
+    {
+        size_t candidate = (m_nextWorker + i) % m_workers.size();
+        if (m_workers[candidate].numaNode == numaNode)
+        {
+            worker = candidate;
+            m_nextWorker = candidate + 1;
+            break;
+        }
+    }
+    LeaveCriticalSection(&m_critSec);
+    return worker;
+}
+
+void SourceHost::OnConsumer(MediaSource* pSource, const PROCESSOR_NUMBER& processor)
+{
+    USHORT numaNode = 0;
+    if (!GetNumaProcessorNodeEx(const_cast<PROCESSOR_NUMBER*>(&processor), &numaNode))
+    {
+        return;
+    }
+    if (pSource->NumaNode() == numaNode)
+    {
+        return;
+    }
+
+    size_t worker = NextWorkerOnNode(numaNode);
+    if (worker != SIZE_MAX)
+    {
+        pSource->SetPlacement(m_workers[worker].workQueue, numaNode);
+    }
+}
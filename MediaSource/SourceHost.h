@@ -0,0 +1,61 @@
+#pragma once
+#include "MediaSource.h"
+#include "AsyncCallback.h"
+
+// How a SourceHost assigns sources to workers.
+enum class PlacementPolicy
+{
+    SHARED,             // One multithreaded work queue, no pinning.
+    ROUND_ROBIN,        // Pinned workers, sources spread across them in turn.
+    FOLLOW_CONSUMER,    // Round robin, then moved to the consumer's NUMA node on the first RequestSample.
+    EXPLICIT            // Pinned workers, caller picks the node or processor.
+};
+
+// Hosting mode for large numbers of sources. Every source created through the
+// host runs its OpQueue on a work queue owned by the host, so an idle source
+// owns no threads and no event queues. With a pinned policy the host starts
+// one single-threaded work queue per logical processor, pins its thread, and
+// sources allocate their sample pools on that processor's NUMA node. The host
+// must outlive the sources it creates.
+class SourceHost : public winrt::implements<SourceHost, IUnknown>
+{
+public:
+    static HRESULT Create(SourceHost** ppHost, PlacementPolicy policy = PlacementPolicy::SHARED);
+
+    SourceHost(PlacementPolicy policy);
+    ~SourceHost();
+
+    HRESULT CreateSource(SampleProducer* pProducer, MediaSource** ppSource);
+    HRESULT CreateSourceOnNode(USHORT numaNode, SampleProducer* pProducer, MediaSource** ppSource);
+    HRESULT CreateSourceOnProcessor(const PROCESSOR_NUMBER& processor, SampleProducer* pProducer, MediaSource** ppSource);
+
+    DWORD GetWorkQueue() const { return m_workQueue; }
+    PlacementPolicy GetPolicy() const { return m_policy; }
+
+protected:
+    HRESULT Initialize();
+    HRESULT StartWorkers();
+    HRESULT OnPinWorker(IMFAsyncResult* pResult);
+    HRESULT CreateSourceOnWorker(size_t worker, SampleProducer* pProducer, MediaSource** ppSource);
+    size_t NextWorker();
+    size_t NextWorkerOnNode(USHORT numaNode);
+    void OnConsumer(MediaSource* pSource, const PROCESSOR_NUMBER& processor);
+
+private:
+    struct Worker
+    {
+        DWORD workQueue;
+        USHORT numaNode;
+        GROUP_AFFINITY affinity;
+    };
+
+    CRITICAL_SECTION m_critSec;
+    PlacementPolicy m_policy;
+    DWORD m_workQueue = 0;
+    std::vector<Worker> m_workers;
+    size_t m_nextWorker = 0;
+
+    AsyncCallback<SourceHost> m_onPinWorker;
+    size_t m_pinWorker = 0;
+    HANDLE m_pinned = NULL;
+};
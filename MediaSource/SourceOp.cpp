@@ -46,6 +46,23 @@ HRESULT SourceOp::CreateStartOp(IMFPresentationDescriptor* pPD, SourceOp** ppOp)
     return S_OK;
 }
 
+HRESULT SourceOp::CreateSetRateOp(BOOL fThin, float flRate, SourceOp** ppOp)
+{
+    if (ppOp == NULL)
+    {
+        return E_POINTER;
+    }
+
+    auto pOp = winrt::make_self<SetRateOp>(fThin, flRate);
+    if (pOp == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    *ppOp = pOp.detach();
+    return S_OK;
+}
+
 HRESULT SourceOp::SetData(const PROPVARIANT& var)
 {
     return PropVariantCopy(&m_data, &var);
@@ -71,4 +88,11 @@ HRESULT StartOp::GetPresentationDescriptor(IMFPresentationDescriptor** ppPD)
     }
     m_presentationDesc.copy_to(ppPD);
     return S_OK;
-}
\ No newline at end of file
+}
+
+SetRateOp::SetRateOp(BOOL fThin, float flRate)
+    : SourceOp(Operation::OP_SET_RATE), m_thin(fThin), m_rate(flRate)
+{
+}
+
+SetRateOp::~SetRateOp() {}
\ No newline at end of file
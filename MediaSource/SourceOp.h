@@ -6,7 +6,10 @@ enum class Operation
     OP_PAUSE,
     OP_STOP,
     OP_REQUEST_DATA,
-    OP_END_OF_STREAM
+    OP_END_OF_STREAM,
+    OP_OPEN,
+    OP_SET_RATE,
+    OP_SET_PLACEMENT
 };
 
 class SourceOp : public winrt::implements<SourceOp, IUnknown>
@@ -14,6 +17,7 @@ class SourceOp : public winrt::implements<SourceOp, IUnknown>
 public:
     static HRESULT CreateOp(Operation op, SourceOp** ppOp);
     static HRESULT CreateStartOp(IMFPresentationDescriptor* pPD, SourceOp** ppOp);
+    static HRESULT CreateSetRateOp(BOOL fThin, float flRate, SourceOp** ppOp);
 
     SourceOp(Operation op);
     virtual ~SourceOp();
@@ -23,9 +27,13 @@ public:
     Operation Op() const { return m_op; }
     const PROPVARIANT& Data() { return m_data; }
 
+    LONGLONG EnqueueTime() const { return m_enqueueTime; }
+    void SetEnqueueTime(LONGLONG time) { m_enqueueTime = time; }
+
 protected:
     Operation   m_op;
     PROPVARIANT m_data;     // Data for the operation.
+    LONGLONG    m_enqueueTime = 0;  // Trace clock time when the op was queued.
 };
 
 class StartOp : public SourceOp
@@ -38,4 +46,18 @@ public:
 
 protected:
     winrt::com_ptr<IMFPresentationDescriptor> m_presentationDesc;
+};
+
+class SetRateOp : public SourceOp
+{
+public:
+    SetRateOp(BOOL fThin, float flRate);
+    ~SetRateOp();
+
+    BOOL IsThin() const { return m_thin; }
+    float GetRate() const { return m_rate; }
+
+protected:
+    BOOL m_thin;
+    float m_rate;
 };
\ No newline at end of file
@@ -0,0 +1,89 @@
+#include "pch.h"
+#include "StartCodeScanner.h"
+#include <intrin.h>
+#include <immintrin.h>
+
+typedef size_t(*FindFunction)(const BYTE* pData, size_t length);
+
+static size_t FindScalar(const BYTE* pData, size_t length)
+{
+    for (size_t i = 0; i + 2 < length; i++)
+    {
+        if (pData[i] == 0 && pData[i + 1] == 0 && pData[i + 2] == 1)
+        {
+            return i;
+        }
+    }
+    return length;
+}
+
+// Each block tests the 16 (or 32) candidate positions starting at i, reading
+// two bytes past the block. The remainder is finished with the scalar loop.
+static size_t FindSse2(const BYTE* pData, size_t length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    size_t i = 0;
+    for (; i + 18 <= length; i += 16)
+    {
+        __m128i b0 = _mm_loadu_si128((const __m128i*)(pData + i));
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(pData + i + 1));
+        __m128i b2 = _mm_loadu_si128((const __m128i*)(pData + i + 2));
+        __m128i match = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)), _mm_cmpeq_epi8(b2, one));
+        unsigned long mask = (unsigned long)_mm_movemask_epi8(match);
+        if (mask != 0)
+        {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            return i + bit;
+        }
+    }
+    return i + FindScalar(pData + i, length - i);
+}
+
+static size_t FindAvx2(const BYTE* pData, size_t length)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    size_t i = 0;
+    for (; i + 34 <= length; i += 32)
+    {
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)(pData + i));
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(pData + i + 1));
+        __m256i b2 = _mm256_loadu_si256((const __m256i*)(pData + i + 2));
+        __m256i match = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(b0, zero), _mm256_cmpeq_epi8(b1, zero)), _mm256_cmpeq_epi8(b2, one));
+        unsigned long mask = (unsigned long)_mm256_movemask_epi8(match);
+        if (mask != 0)
+        {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            return i + bit;
+        }
+    }
+    return i + FindSse2(pData + i, length - i);
+}
+
+static FindFunction GetFindFunction(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::AVX2:
+        return FindAvx2;
+    case SimdLevel::SSE2:
+        return FindSse2;
+    default:
+        return FindScalar;
+    }
+}
+
+static const FindFunction s_find = GetFindFunction(CpuFeatures::GetSimdLevel());
+
+size_t StartCodeScanner::Find(const BYTE* pData, size_t length)
+{
+    return s_find(pData, length);
+}
+
+size_t StartCodeScanner::FindWith(SimdLevel level, const BYTE* pData, size_t length)
+{
+    return GetFindFunction(level)(pData, length);
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include "CpuFeatures.h"
+
+// Finds Annex-B start codes (00 00 01). Find uses the widest instruction set
+// the CPU supports; FindWith runs a given level, for comparison.
+class StartCodeScanner
+{
+public:
+    // Offset of the first start code in pData, or length if there is none.
+    static size_t Find(const BYTE* pData, size_t length);
+    static size_t FindWith(SimdLevel level, const BYTE* pData, size_t length);
+};
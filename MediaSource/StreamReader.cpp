@@ -0,0 +1,228 @@
+#include "pch.h"
+#include "StreamReader.h"
+#include "SampleSlices.h"
+
+StreamReader::StreamReader(AsyncFile* pFile, SamplePool* pPool, DWORD maxInFlight)
+    : m_maxInFlight(maxInFlight > 0 ? maxInFlight : 1)
+{
+    InitializeCriticalSection(&m_critSec);
+    m_file.copy_from(pFile);
+    m_pool.copy_from(pPool);
+}
+
+StreamReader::~StreamReader()
+{
+    DeleteCriticalSection(&m_critSec);
+}
+
+HRESULT StreamReader::Enqueue(ULONGLONG offset, DWORD length, LONGLONG time, LONGLONG duration, bool cleanPoint)
+{
+    if (length == 0 || length > m_pool->BufferSize())
+    {
+        return E_INVALIDARG;
+    }
+
+    PendingSample sample;
+    sample.offset = offset;
+    sample.length = length;
+    sample.time = time;
+    sample.duration = duration;
+    sample.cleanPoint = cleanPoint;
+
+    EnterCriticalSection(&m_critSec);
+    m_queued.push_back(sample);
+    LeaveCriticalSection(&m_critSec);
+    return S_OK;
+}
+
+HRESULT StreamReader::GetCompleted(IMFSample** ppSample)
+{
+    if (ppSample == NULL)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+    EnterCriticalSection(&m_critSec);
+    if (!m_completed.empty())
+    {
+        *ppSample = m_completed.front().detach();
+        m_completed.pop();
+    }
+    else if (FAILED(m_error))
+    {
+        hr = m_error;
+    }
+    else if (!m_inFlight.empty() || !m_queued.empty())
+    {
+        hr = IssueReads();
+        if (SUCCEEDED(hr))
+        {
+            hr = E_PENDING;
+        }
+    }
+    else
+    {
+        hr = S_FALSE;
+    }
+    LeaveCriticalSection(&m_critSec);
+    return hr;
+}
+
+void StreamReader::SetDataReadyCallback(DataReadyCallback callback)
+{
+    EnterCriticalSection(&m_critSec);
+    m_onDataReady = callback;
+    LeaveCriticalSection(&m_critSec);
+}
+
+void StreamReader::Cancel()
+{
+    EnterCriticalSection(&m_critSec);
+    m_generation++;
+    m_queued.clear();
+    m_inFlight.clear();
+    while (!m_completed.empty())
+    {
+        m_completed.pop();
+    }
+    m_error = S_OK;
+    LeaveCriticalSection(&m_critSec);
+}
+
+size_t StreamReader::QueuedCount()
+{
+    EnterCriticalSection(&m_critSec);
+    size_t count = m_queued.size() + m_completed.size();
+    for (auto& request : m_inFlight)
+    {
+        count += request->samples.size();
+    }
+    LeaveCriticalSection(&m_critSec);
+    return count;
+}
+
+void StreamReader::GetCounters(ReaderCounters* pCounters)
+{
+    EnterCriticalSection(&m_critSec);
+    *pCounters = m_counters;
+    LeaveCriticalSection(&m_critSec);
+}
+
+// Called with m_critSec held.
+HRESULT StreamReader::IssueReads()
+{
+    HRESULT hr = S_OK;
+    const DWORD maxLength = m_pool->BufferSize();
+
+    while (m_outstanding < m_maxInFlight && !m_queued.empty())
+    {
+        // Take every queued sample that continues the previous one and still
+        // fits in a pool buffer.
+        auto request = std::make_shared<ReadRequest>();
+        request->offset = m_queued.front().offset;
+        while (!m_queued.empty())
+        {
+            const PendingSample& next = m_queued.front();
+            if (next.offset != request->offset + request->length || request->length + next.length > maxLength)
+            {
+                break;
+            }
+            request->length += next.length;
+            request->samples.push_back(next);
+            m_queued.pop_front();
+        }
+
+        // Pool buffers are plain system memory, so the pointer stays valid
+        // for as long as the pool sample is held.
+        winrt::com_ptr<IMFMediaBuffer> buffer;
+        CHECK_HR(hr = m_pool->AcquireSample(request->poolSample.put()));
+        CHECK_HR(hr = request->poolSample->GetBufferByIndex(0, buffer.put()));
+        CHECK_HR(hr = buffer->Lock(&request->data, NULL, NULL));
+        (void)buffer->Unlock();
+
+        // The completion holds the request, and with it the pool buffer the
+        // read is writing into, even if Cancel drops it from m_inFlight.
+        auto self = get_strong();
+        ULONGLONG generation = m_generation;
+        CHECK_HR(hr = m_file->ReadAt(request->offset, request->data, request->length,
+            [self, request, generation](HRESULT hrRead, DWORD bytesRead)
+            {
+                self->OnReadComplete(request, generation, hrRead, bytesRead);
+            }));
+
+        m_outstanding++;
+        m_counters.requests++;
+        m_counters.samples += request->samples.size();
+        m_inFlight.push_back(request);
+    }
+    return hr;
+}
+
+// Called with m_critSec held.
+HRESULT StreamReader::CompleteRequest(ReadRequest& request)
+{
+    HRESULT hr = S_OK;
+    for (const PendingSample& pending : request.samples)
+    {
+        winrt::com_ptr<IMFSample> sample;
+        CHECK_HR(hr = MFCreateSample(sample.put()));
+        CHECK_HR(hr = SampleSlices::AddSlice(sample.get(), request.poolSample.get(),
+            request.data + (pending.offset - request.offset), pending.length));
+        CHECK_HR(hr = sample->SetSampleTime(pending.time));
+        CHECK_HR(hr = sample->SetSampleDuration(pending.duration));
+        if (pending.cleanPoint)
+        {
+            CHECK_HR(hr = sample->SetUINT32(MFSampleExtension_CleanPoint, TRUE));
+        }
+        m_completed.push(sample);
+    }
+    return hr;
+}
+
+void StreamReader::OnReadComplete(std::shared_ptr<ReadRequest> request, ULONGLONG generation, HRESULT hr, DWORD bytesRead)
+{
+    DataReadyCallback callback;
+
+    EnterCriticalSection(&m_critSec);
+    m_outstanding--;
+    if (generation == m_generation)
+    {
+        request->complete = true;
+        request->status = SUCCEEDED(hr) && bytesRead < request->length ? HRESULT_FROM_WIN32(ERROR_HANDLE_EOF) : hr;
+
+        // Reads can finish out of order; samples are released in order.
+        bool ready = false;
+        while (!m_inFlight.empty() && m_inFlight.front()->complete)
+        {
+            ReadRequest& front = *m_inFlight.front();
+            HRESULT hrComplete = FAILED(front.status) ? front.status : CompleteRequest(front);
+            if (FAILED(hrComplete) && SUCCEEDED(m_error))
+            {
+                m_error = hrComplete;
+            }
+            m_inFlight.pop_front();
+            ready = true;
+        }
+
+        if (SUCCEEDED(m_error))
+        {
+            HRESULT hrIssue = IssueReads();
+            if (FAILED(hrIssue))
+            {
+                m_error = hrIssue;
+                ready = true;
+            }
+        }
+        if (ready)
+        {
+            callback = m_onDataReady;
+        }
+    }
+    LeaveCriticalSection(&m_critSec);
+
+    if (callback)
+    {
+        callback();
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <mfapi.h>
+#include <deque>
+#include <memory>
+#include <queue>
+#include <vector>
+#include "AsyncFile.h"
+#include "SamplePool.h"
+#include "SampleProducer.h"
+
+struct ReaderCounters
+{
+    LONGLONG requests;      // Reads issued.
+    LONGLONG samples;       // Samples carried by those reads.
+};
+
+// Reads one stream's samples from an AsyncFile ahead of demand. A producer
+// enqueues where each sample lies in the file; adjacent samples are
+// coalesced into one read of up to the pool's buffer size, at most
+// maxInFlight reads are outstanding, and each read lands directly in a
+// pooled buffer that its samples then slice without copying. Completed
+// samples come out in the order they were enqueued. Reads are issued from
+// GetCompleted and as earlier reads finish, so samples enqueued together
+// can be coalesced.
+class StreamReader : public winrt::implements<StreamReader, IUnknown>
+{
+public:
+    StreamReader(AsyncFile* pFile, SamplePool* pPool, DWORD maxInFlight);
+    ~StreamReader();
+
+    HRESULT Enqueue(ULONGLONG offset, DWORD length, LONGLONG time, LONGLONG duration, bool cleanPoint);
+
+    // Next completed sample. E_PENDING while it is still being read, S_FALSE
+    // when nothing is enqueued.
+    HRESULT GetCompleted(IMFSample** ppSample);
+
+    // Called from an I/O thread whenever GetCompleted has something new.
+    void SetDataReadyCallback(DataReadyCallback callback);
+
+    // Drop everything enqueued or completed; reads in flight finish unseen.
+    void Cancel();
+
+    size_t QueuedCount();
+    void GetCounters(ReaderCounters* pCounters);
+
+private:
+    struct PendingSample
+    {
+        ULONGLONG offset;
+        DWORD length;
+        LONGLONG time;
+        LONGLONG duration;
+        bool cleanPoint;
+    };
+
+    struct ReadRequest
+    {
+        ULONGLONG offset = 0;
+        DWORD length = 0;
+        winrt::com_ptr<IMFSample> poolSample;
+        BYTE* data = nullptr;
+        std::vector<PendingSample> samples;
+        bool complete = false;
+        HRESULT status = S_OK;
+    };
+
+    HRESULT IssueReads();
+    HRESULT CompleteRequest(ReadRequest& request);
+    void OnReadComplete(std::shared_ptr<ReadRequest> request, ULONGLONG generation, HRESULT hr, DWORD bytesRead);
+
+    CRITICAL_SECTION m_critSec;
+    winrt::com_ptr<AsyncFile> m_file;
+    winrt::com_ptr<SamplePool> m_pool;
+    DWORD m_maxInFlight;
+    DWORD m_outstanding = 0;
+    ULONGLONG m_generation = 0;     // Bumped by Cancel so stale completions are ignored.
+    HRESULT m_error = S_OK;
+
+    std::deque<PendingSample> m_queued;
+    std::deque<std::shared_ptr<ReadRequest>> m_inFlight;
+    std::queue<winrt::com_ptr<IMFSample>> m_completed;
+    DataReadyCallback m_onDataReady;
+    ReaderCounters m_counters = {};
+};
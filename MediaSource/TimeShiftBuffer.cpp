@@ -0,0 +1,329 @@
+#include "pch.h"
+#include "TimeShiftBuffer.h"
+#include <Mferror.h>
+#include <algorithm>
+
+TimeShiftBuffer::TimeShiftBuffer(LONGLONG window, SIZE_T ramThreshold, SIZE_T spillCapacity)
+    : m_window(window), m_ramThreshold(ramThreshold), m_spillCapacity(spillCapacity)
+{
+}
+
+TimeShiftBuffer::~TimeShiftBuffer()
+{
+    Clear();
+    if (m_spillView != nullptr)
+    {
+        UnmapViewOfFile(m_spillView);
+    }
+    if (m_spillMapping != NULL)
+    {
+        CloseHandle(m_spillMapping);
+    }
+    if (m_spillFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_spillFile);
+    }
+}
+
+HRESULT TimeShiftBuffer::Append(IMFSample* pSample)
+{
+    if (pSample == NULL)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+    Entry entry = {};
+    entry.sequence = m_nextSequence++;
+    CHECK_HR(hr = pSample->GetSampleTime(&entry.time));
+    (void)pSample->GetSampleDuration(&entry.duration);
+    entry.cleanPoint = MFGetAttributeUINT32(pSample, MFSampleExtension_CleanPoint, FALSE) != FALSE;
+    CHECK_HR(hr = pSample->GetTotalLength(&entry.length));
+
+    // The delivered sample carries the request's token, and a pooled one has
+    // its buffers recycled once released, so the ring keeps its own sample.
+    winrt::com_ptr<IMFTrackedSample> tracked;
+    bool pooled = SUCCEEDED(pSample->QueryInterface(IID_PPV_ARGS(tracked.put())));
+    CHECK_HR(hr = CloneSample(pSample, pooled, entry.sample.put()));
+
+    m_entries.push_back(entry);
+    m_ramBytes += entry.length;
+
+    while (!m_entries.empty() && entry.time - m_entries.front().time > m_window)
+    {
+        EvictFront();
+    }
+    while (m_ramBytes > m_ramThreshold && m_spilledCount < m_entries.size())
+    {
+        CHECK_HR(hr = SpillOldest());
+    }
+    return hr;
+}
+
+void TimeShiftBuffer::Clear()
+{
+    while (!m_entries.empty())
+    {
+        EvictFront();
+    }
+    m_spillWrite = 0;
+}
+
+bool TimeShiftBuffer::Contains(LONGLONG time) const
+{
+    return !m_entries.empty() && time >= m_entries.front().time && time <= m_entries.back().time;
+}
+
+HRESULT TimeShiftBuffer::Seek(LONGLONG time, ULONGLONG* pSequence)
+{
+    if (pSequence == NULL)
+    {
+        return E_POINTER;
+    }
+    if (!Contains(time))
+    {
+        return MF_E_OUT_OF_RANGE;
+    }
+
+    // First entry after time, then walk back to the sync sample before it.
+    auto it = std::upper_bound(m_entries.begin(), m_entries.end(), time,
+        [](LONGLONG value, const Entry& entry) { return value < entry.time; });
+    while (it != m_entries.begin())
+    {
+        --it;
+        if (it->cleanPoint)
+        {
+            *pSequence = it->sequence;
+            return S_OK;
+        }
+    }
+    return MF_E_OUT_OF_RANGE;
+}
+
+HRESULT TimeShiftBuffer::GetNext(ULONGLONG* pSequence, IMFSample** ppSample)
+{
+    if (pSequence == NULL || ppSample == NULL)
+    {
+        return E_POINTER;
+    }
+    if (m_entries.empty() || *pSequence > m_entries.back().sequence)
+    {
+        return S_FALSE;
+    }
+
+    HRESULT hr = S_OK;
+    ULONGLONG sequence = (std::max)(*pSequence, m_entries.front().sequence);
+    const Entry& entry = m_entries[(size_t)(sequence - m_entries.front().sequence)];
+    *pSequence = sequence + 1;
+
+    if (entry.sample != nullptr)
+    {
+        // A fresh sample each time, so attributes set on one delivery do not
+        // carry over to the next replay of the same entry.
+        return CloneSample(entry.sample.get(), false, ppSample);
+    }
+
+    // Spilled: rebuild a sample from the mapped file.
+    winrt::com_ptr<IMFSample> sample;
+    winrt::com_ptr<IMFMediaBuffer> buffer;
+    BYTE* data = nullptr;
+    CHECK_HR(hr = MFCreateSample(sample.put()));
+    CHECK_HR(hr = MFCreateMemoryBuffer(entry.length, buffer.put()));
+    CHECK_HR(hr = buffer->Lock(&data, NULL, NULL));
+    memcpy(data, m_spillView + entry.spillOffset, entry.length);
+    CHECK_HR(hr = buffer->Unlock());
+    CHECK_HR(hr = buffer->SetCurrentLength(entry.length));
+    CHECK_HR(hr = sample->AddBuffer(buffer.get()));
+    CHECK_HR(hr = sample->SetSampleTime(entry.time));
+    CHECK_HR(hr = sample->SetSampleDuration(entry.duration));
+    CHECK_HR(hr = sample->SetUINT32(MFSampleExtension_CleanPoint, entry.cleanPoint));
+    *ppSample = sample.detach();
+    return hr;
+}
+
+// A new sample with pSample's times and attributes, minus the ones that
+// belong to a single delivery. The payload is shared unless copyPayload.
+HRESULT TimeShiftBuffer::CloneSample(IMFSample* pSample, bool copyPayload, IMFSample** ppClone)
+{
+    HRESULT hr = S_OK;
+    winrt::com_ptr<IMFSample> clone;
+    LONGLONG time = 0;
+    LONGLONG duration = 0;
+    CHECK_HR(hr = MFCreateSample(clone.put()));
+    CHECK_HR(hr = pSample->CopyAllItems(clone.get()));
+    (void)clone->DeleteItem(MFSampleExtension_Token);
+    (void)clone->DeleteItem(MFSampleExtension_Discontinuity);
+    CHECK_HR(hr = pSample->GetSampleTime(&time));
+    CHECK_HR(hr = clone->SetSampleTime(time));
+    if (SUCCEEDED(pSample->GetSampleDuration(&duration)))
+    {
+        CHECK_HR(hr = clone->SetSampleDuration(duration));
+    }
+
+    if (copyPayload)
+    {
+        winrt::com_ptr<IMFMediaBuffer> buffer;
+        DWORD length = 0;
+        CHECK_HR(hr = pSample->GetTotalLength(&length));
+        CHECK_HR(hr = MFCreateMemoryBuffer(length, buffer.put()));
+        CHECK_HR(hr = pSample->CopyToBuffer(buffer.get()));
+        CHECK_HR(hr = clone->AddBuffer(buffer.get()));
+    }
+    else
+    {
+        DWORD bufferCount = 0;
+        CHECK_HR(hr = pSample->GetBufferCount(&bufferCount));
+        for (DWORD i = 0; i < bufferCount; i++)
+        {
+            winrt::com_ptr<IMFMediaBuffer> buffer;
+            CHECK_HR(hr = pSample->GetBufferByIndex(i, buffer.put()));
+            CHECK_HR(hr = clone->AddBuffer(buffer.get()));
+        }
+    }
+
+    *ppClone = clone.detach();
+    return hr;
+}
+
+void TimeShiftBuffer::GetStats(TimeShiftStats* pStats) const
+{
+    pStats->bufferedDuration = m_entries.empty() ? 0 : m_entries.back().time - m_entries.front().time;
+    pStats->ramBytes = m_ramBytes;
+    pStats->spilledBytes = m_spilledBytes;
+}
+
+HRESULT TimeShiftBuffer::SpillOldest()
+{
+    HRESULT hr = S_OK;
+    CHECK_HR(hr = EnsureSpillFile());
+
+    Entry& entry = m_entries[m_spilledCount];
+    SIZE_T offset = 0;
+    hr = ReserveSpill(entry.length, &offset);
+    if (hr == MF_E_OUT_OF_RANGE)
+    {
+        // Too large for the spill file. Drop from the front; the caller keeps
+        // spilling until this entry is the one dropped.
+        EvictFront();
+        return S_OK;
+    }
+    CHECK_HR(hr);
+
+    // ReserveSpill may have evicted spilled entries, so look the entry up again.
+    Entry& target = m_entries[m_spilledCount];
+    DWORD bufferCount = 0;
+    SIZE_T written = 0;
+    CHECK_HR(hr = target.sample->GetBufferCount(&bufferCount));
+    for (DWORD i = 0; i < bufferCount; i++)
+    {
+        winrt::com_ptr<IMFMediaBuffer> buffer;
+        BYTE* data = nullptr;
+        DWORD length = 0;
+        CHECK_HR(hr = target.sample->GetBufferByIndex(i, buffer.put()));
+        CHECK_HR(hr = buffer->Lock(&data, NULL, &length));
+        memcpy(m_spillView + offset + written, data, length);
+        written += length;
+        (void)buffer->Unlock();
+    }
+
+    target.sample = nullptr;
+    target.spillOffset = offset;
+    m_ramBytes -= target.length;
+    m_spilledBytes += target.length;
+    m_spilledCount++;
+    m_spillWrite = offset + target.length;
+    return hr;
+}
+
+HRESULT TimeShiftBuffer::EnsureSpillFile()
+{
+    if (m_spillView != nullptr)
+    {
+        return S_OK;
+    }
+
+    WCHAR directory[MAX_PATH];
+    WCHAR path[MAX_PATH];
+    if (GetTempPathW(MAX_PATH, directory) == 0 || GetTempFileNameW(directory, L"tsb", 0, path) == 0)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    m_spillFile = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (m_spillFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    ULARGE_INTEGER size;
+    size.QuadPart = m_spillCapacity;
+    m_spillMapping = CreateFileMappingW(m_spillFile, NULL, PAGE_READWRITE, size.HighPart, size.LowPart, NULL);
+    if (m_spillMapping == NULL)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    m_spillView = (BYTE*)MapViewOfFile(m_spillMapping, FILE_MAP_ALL_ACCESS, 0, 0, m_spillCapacity);
+    if (m_spillView == nullptr)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    return S_OK;
+}
+
+// Spilled payloads are laid out in the file as a FIFO ring in entry order.
+HRESULT TimeShiftBuffer::ReserveSpill(DWORD length, SIZE_T* pOffset)
+{
+    if (length > m_spillCapacity)
+    {
+        return MF_E_OUT_OF_RANGE;
+    }
+
+    for (;;)
+    {
+        if (m_spilledCount == 0)
+        {
+            m_spillWrite = 0;
+            *pOffset = 0;
+            return S_OK;
+        }
+
+        SIZE_T tail = m_entries.front().spillOffset;
+        if (m_spillWrite > tail)
+        {
+            // Free space is [write, capacity) and [0, tail).
+            if (m_spillCapacity - m_spillWrite >= length)
+            {
+                *pOffset = m_spillWrite;
+                return S_OK;
+            }
+            if (tail > length)
+            {
+                *pOffset = 0;
+                return S_OK;
+            }
+        }
+        else if (tail - m_spillWrite > length)
+        {
+            // Wrapped: free space is [write, tail).
+            *pOffset = m_spillWrite;
+            return S_OK;
+        }
+        EvictFront();
+    }
+}
+
+void TimeShiftBuffer::EvictFront()
+{
+    Entry& entry = m_entries.front();
+    if (entry.sample == nullptr)
+    {
+        m_spilledBytes -= entry.length;
+        m_spilledCount--;
+    }
+    else
+    {
+        m_ramBytes -= entry.length;
+    }
+    m_entries.pop_front();
+}
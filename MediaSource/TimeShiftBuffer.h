@@ -0,0 +1,77 @@
+#pragma once
+#include <mfapi.h>
+#include <deque>
+
+struct TimeShiftStats
+{
+    LONGLONG bufferedDuration = 0;  // Newest minus oldest sample time, 100ns units.
+    SIZE_T ramBytes = 0;            // Payload held as samples in memory.
+    SIZE_T spilledBytes = 0;        // Payload held in the spill file.
+    LONGLONG lastSeekLatency = 0;   // Start to first replayed MEMediaSample, 100ns units.
+
+    double BytesPerMinute() const
+    {
+        return bufferedDuration > 0 ? (double)(ramBytes + spilledBytes) * 600000000.0 / (double)bufferedDuration : 0;
+    }
+};
+
+// Ring of recently delivered samples for one stream, indexed by time and
+// sync samples. The newest samples are kept in memory as copies of the
+// delivered ones, without their request tokens and sharing their payload
+// unless it belongs to a sample pool; once they exceed ramThreshold bytes the
+// oldest are copied into a memory-mapped spill file of spillCapacity bytes.
+// Anything older than window is dropped.
+// Not locked; the owning stream serialises access with the source lock.
+class TimeShiftBuffer
+{
+public:
+    TimeShiftBuffer(LONGLONG window, SIZE_T ramThreshold, SIZE_T spillCapacity);
+    ~TimeShiftBuffer();
+
+    HRESULT Append(IMFSample* pSample);
+    void Clear();
+
+    bool Contains(LONGLONG time) const;
+
+    // Sequence number of the last sync sample at or before time.
+    HRESULT Seek(LONGLONG time, ULONGLONG* pSequence);
+
+    // Return a new sample for the one at *pSequence (or the oldest one, if
+    // that has been evicted) and advance *pSequence. S_FALSE once past the
+    // newest sample.
+    HRESULT GetNext(ULONGLONG* pSequence, IMFSample** ppSample);
+
+    void GetStats(TimeShiftStats* pStats) const;
+
+private:
+    struct Entry
+    {
+        ULONGLONG sequence;
+        LONGLONG time;
+        LONGLONG duration;
+        bool cleanPoint;
+        DWORD length;
+        winrt::com_ptr<IMFSample> sample;   // Null once spilled.
+        SIZE_T spillOffset;
+    };
+
+    static HRESULT CloneSample(IMFSample* pSample, bool copyPayload, IMFSample** ppClone);
+    HRESULT SpillOldest();
+    HRESULT EnsureSpillFile();
+    HRESULT ReserveSpill(DWORD length, SIZE_T* pOffset);
+    void EvictFront();
+
+    std::deque<Entry> m_entries;
+    size_t m_spilledCount = 0;      // Spilled entries are always the oldest ones.
+    ULONGLONG m_nextSequence = 0;
+    LONGLONG m_window;
+    SIZE_T m_ramThreshold;
+    SIZE_T m_ramBytes = 0;
+    SIZE_T m_spilledBytes = 0;
+
+    SIZE_T m_spillCapacity;
+    SIZE_T m_spillWrite = 0;
+    HANDLE m_spillFile = INVALID_HANDLE_VALUE;
+    HANDLE m_spillMapping = NULL;
+    BYTE* m_spillView = nullptr;
+};
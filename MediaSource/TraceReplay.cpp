@@ -0,0 +1,222 @@
+#include "pch.h"
+#include "TraceReplay.h"
+#include <algorithm>
+
+const DWORD REPLAY_IDLE_TIMEOUT_MS = 1000;
+
+TraceReplay::TraceReplay(Pacing pacing) : m_pacing(pacing)
+{
+}
+
+TraceReplay::~TraceReplay()
+{
+    OpTrace::UseVirtualClock(false);
+}
+
+HRESULT TraceReplay::Run(const std::vector<TraceRecord>& records)
+{
+    HRESULT hr = S_OK;
+    if (records.empty())
+    {
+        return S_OK;
+    }
+
+    const LONGLONG traceStart = records.front().time;
+    CountStreams(records);
+    if (m_pacing == Pacing::Stepped)
+    {
+        ModelServiceTimes(records);
+    }
+    OpTrace::UseVirtualClock(m_pacing == Pacing::Stepped);
+    const LONGLONG replayStart = OpTrace::Now();
+
+    for (const TraceRecord& record : records)
+    {
+        if (m_pacing == Pacing::Stepped)
+        {
+            OpTrace::SetVirtualTime(record.time);
+        }
+        else
+        {
+            // Wait until the record's offset from the start of the trace.
+            LONGLONG due = replayStart + (record.time - traceStart);
+            LONGLONG now = OpTrace::Now();
+            if (due > now)
+            {
+                Sleep((DWORD)((due - now) / 10000));
+            }
+        }
+
+        CHECK_HR(hr = Apply(record));
+
+        if (m_pacing == Pacing::Stepped)
+        {
+            WaitForIdle();
+        }
+    }
+
+    WaitForIdle();
+    OpTrace::UseVirtualClock(false);
+    return hr;
+}
+
+// An op's service time is only visible in the recording when the source was
+// busy throughout: the next op on the source was already queued when it was
+// dispatched, so the gap between the two dispatches is the op's run time.
+// Each kind takes the median of its gaps; kinds that were never seen back to
+// back take the median over all kinds.
+void TraceReplay::ModelServiceTimes(const std::vector<TraceRecord>& records)
+{
+    std::map<uint32_t, const TraceRecord*> lastDispatch;
+    std::map<uint8_t, std::vector<LONGLONG>> gaps;
+    std::vector<LONGLONG> allGaps;
+    for (const TraceRecord& record : records)
+    {
+        if ((TraceEvent)record.kind != TraceEvent::OP_DISPATCH)
+        {
+            continue;
+        }
+        const TraceRecord*& previous = lastDispatch[record.source];
+        if (previous != nullptr && record.aux != 0 && record.aux <= previous->time)
+        {
+            gaps[previous->op].push_back(record.time - previous->time);
+            allGaps.push_back(record.time - previous->time);
+        }
+        previous = &record;
+    }
+
+    auto median = [](std::vector<LONGLONG>& values)
+    {
+        std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+        return values[values.size() / 2];
+    };
+    LONGLONG fallback = allGaps.empty() ? 0 : median(allGaps);
+    for (int op = 0; op < 256; op++)
+    {
+        auto found = gaps.find((uint8_t)op);
+        OpTrace::SetServiceTime((uint8_t)op, found != gaps.end() ? median(found->second) : fallback);
+    }
+}
+
+// The count recorded when the source opened, or enough streams for every
+// stream index the trace refers to.
+void TraceReplay::CountStreams(const std::vector<TraceRecord>& records)
+{
+    m_streamCounts.clear();
+    for (const TraceRecord& record : records)
+    {
+        DWORD& count = m_streamCounts[record.source];
+        if ((TraceEvent)record.kind == TraceEvent::OP_ENQUEUE && (Operation)record.op == Operation::OP_OPEN)
+        {
+            count = (std::max)(count, (DWORD)record.aux);
+        }
+        else if ((TraceEvent)record.kind != TraceEvent::OP_ENQUEUE && (TraceEvent)record.kind != TraceEvent::OP_DISPATCH)
+        {
+            count = (std::max)(count, (DWORD)record.stream + 1);
+        }
+    }
+}
+
+HRESULT TraceReplay::GetSource(uint32_t sourceId, MediaSource** ppSource)
+{
+    auto it = m_sources.find(sourceId);
+    if (it == m_sources.end())
+    {
+        winrt::com_ptr<MediaSource> source;
+        MediaSource::Create(source.put());
+        if (source == nullptr)
+        {
+            return E_OUTOFMEMORY;
+        }
+        auto count = m_streamCounts.find(sourceId);
+        source->Initialize(count != m_streamCounts.end() && count->second > 0 ? count->second : 1);
+        it = m_sources.emplace(sourceId, source).first;
+    }
+    it->second.copy_to(ppSource);
+    return S_OK;
+}
+
+HRESULT TraceReplay::Apply(const TraceRecord& record)
+{
+    HRESULT hr = S_OK;
+    winrt::com_ptr<MediaSource> source;
+    winrt::com_ptr<MediaStream> stream;
+
+    CHECK_HR(hr = GetSource(record.source, source.put()));
+
+    // The recorded run may have rejected any of these inputs too, so their
+    // results are not treated as replay failures.
+    switch ((TraceEvent)record.kind)
+    {
+    case TraceEvent::OP_ENQUEUE:
+        switch ((Operation)record.op)
+        {
+        case Operation::OP_START:
+        {
+            winrt::com_ptr<IMFPresentationDescriptor> pd;
+            PROPVARIANT varStart;
+            PropVariantInit(&varStart);
+            if (record.aux != TRACE_NO_VALUE)
+            {
+                varStart.vt = VT_I8;
+                varStart.hVal.QuadPart = record.aux;
+            }
+            CHECK_HR(hr = source->CreatePresentationDescriptor(pd.put()));
+            (void)source->Start(pd.get(), NULL, &varStart);
+            break;
+        }
+        case Operation::OP_STOP:
+            (void)source->Stop();
+            break;
+        case Operation::OP_PAUSE:
+            (void)source->Pause();
+            break;
+        case Operation::OP_SET_RATE:
+            if (record.aux != TRACE_NO_VALUE)
+            {
+                float rate = 1.0f;
+                bool thin = false;
+                UnpackTraceRate(record.aux, &rate, &thin);
+                (void)source->SetRate(thin, rate);
+            }
+            break;
+        default:
+            // OP_OPEN is queued by Initialize, OP_REQUEST_DATA and OP_END_OF_STREAM
+            // by the streams themselves.
+            break;
+        }
+        break;
+
+    case TraceEvent::SAMPLE_REQUEST:
+        CHECK_HR(hr = source->GetStreamByIndex(record.stream, stream.put()));
+        (void)stream->RequestSample(NULL);
+        break;
+
+    case TraceEvent::SAMPLE_ARRIVAL:
+    {
+        winrt::com_ptr<IMFSample> sample;
+        CHECK_HR(hr = source->GetStreamByIndex(record.stream, stream.put()));
+        CHECK_HR(hr = MFCreateSample(sample.put()));
+        CHECK_HR(hr = sample->SetSampleTime(record.aux));
+        (void)stream->QueueSample(sample.get());
+        break;
+    }
+
+    default:
+        // Dispatch and delivery records are outputs, not inputs.
+        break;
+    }
+    return hr;
+}
+
+void TraceReplay::WaitForIdle()
+{
+    ULONGLONG deadline = GetTickCount64() + REPLAY_IDLE_TIMEOUT_MS;
+    for (auto& entry : m_sources)
+    {
+        while (!entry.second->IsIdle() && GetTickCount64() < deadline)
+        {
+            Sleep(0);
+        }
+    }
+}
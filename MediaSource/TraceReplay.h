@@ -0,0 +1,34 @@
+#pragma once
+#include <map>
+#include "MediaSource.h"
+
+// Re-drives MediaSource/MediaStream with the arrival pattern captured by
+// OpTrace. Only external inputs are replayed (Start/Stop/Pause/SetRate with
+// their arguments, RequestSample and producer samples); ops the core queues
+// on its own are regenerated. Each source gets as many streams as it had.
+class TraceReplay
+{
+public:
+    enum class Pacing
+    {
+        Paced,      // Wall clock, inputs issued at their recorded offsets.
+        Stepped     // Virtual clock, each input issued once the previous one has drained;
+                    // ops take the service time modelled from the recorded dispatches.
+    };
+
+    TraceReplay(Pacing pacing);
+    ~TraceReplay();
+
+    HRESULT Run(const std::vector<TraceRecord>& records);
+
+private:
+    static void ModelServiceTimes(const std::vector<TraceRecord>& records);
+    void CountStreams(const std::vector<TraceRecord>& records);
+    HRESULT GetSource(uint32_t sourceId, MediaSource** ppSource);
+    HRESULT Apply(const TraceRecord& record);
+    void WaitForIdle();
+
+    Pacing m_pacing;
+    std::map<uint32_t, winrt::com_ptr<MediaSource>> m_sources;
+    std::map<uint32_t, DWORD> m_streamCounts;
+};
@@ -1,11 +1,1260 @@
 ﻿#include "pch.h"
+#include <psapi.h>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include "TraceReplay.h"
+#include "SourceHost.h"
+#include "StartCodeScanner.h"
+#include "StreamReader.h"
+#include "MixerProducer.h"
+#include "MixKernels.h"
+#include "ChunkCache.h"
+#include "CencDecryptor.h"
+#include "IndexedFileProducer.h"
 
 using namespace winrt;
 using namespace Windows::Foundation;
 
-int main()
+static void PrintLatency(const char* name, const LatencyStats& stats)
+{
+    printf("  %-16s n=%zu p50=%lldus p90=%lldus p99=%lldus max=%lldus\n", name, stats.count,
+        stats.p50 / 10, stats.p90 / 10, stats.p99 / 10, stats.max / 10);
+}
+
+static void PrintStats(const char* title, const std::vector<TraceRecord>& records)
+{
+    TraceStats stats;
+    TraceStats::Compute(records, &stats);
+    printf("%s\n", title);
+    PrintLatency("op queue", stats.opLatency);
+    PrintLatency("sample", stats.sampleLatency);
+}
+
+// MediaSource.exe replay <trace> <output> [stepped]
+static int Replay(int argc, wchar_t* argv[])
+{
+    if (argc < 4)
+    {
+        printf("usage: MediaSource replay <trace> <output> [stepped]\n");
+        return 1;
+    }
+
+    std::vector<TraceRecord> recorded;
+    HRESULT hr = OpTrace::Load(argv[2], recorded);
+    if (FAILED(hr))
+    {
+        printf("failed to load trace: 0x%08X\n", hr);
+        return 1;
+    }
+
+    bool stepped = argc > 4 && wcscmp(argv[4], L"stepped") == 0;
+    MFStartup(MF_VERSION);
+    OpTrace::Start(argv[3]);
+    {
+        TraceReplay replay(stepped ? TraceReplay::Pacing::Stepped : TraceReplay::Pacing::Paced);
+        hr = replay.Run(recorded);
+    }
+    OpTrace::Stop();
+    MFShutdown();
+    if (FAILED(hr))
+    {
+        printf("replay failed: 0x%08X\n", hr);
+        return 1;
+    }
+
+    std::vector<TraceRecord> replayed;
+    OpTrace::Load(argv[3], replayed);
+    PrintStats("recorded", recorded);
+    PrintStats("replayed", replayed);
+    return 0;
+}
+
+static SIZE_T PrivateBytes()
+{
+    PROCESS_MEMORY_COUNTERS_EX counters = {};
+    GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&counters, sizeof(counters));
+    return counters.PrivateUsage;
+}
+
+static void WaitForIdle(std::vector<com_ptr<MediaSource>>& sources)
+{
+    for (auto& source : sources)
+    {
+        while (!source->IsIdle())
+        {
+            Sleep(0);
+        }
+    }
+}
+
+// MediaSource.exe density
+// Bytes per idle source and aggregate op throughput on a shared SourceHost.
+static int Density()
+{
+    const DWORD sourceCounts[] = { 1000, 5000, 10000 };
+    const DWORD opsPerSource = 100;
+
+    MFStartup(MF_VERSION);
+    com_ptr<SourceHost> host;
+    HRESULT hr = SourceHost::Create(host.put());
+    if (FAILED(hr))
+    {
+        printf("failed to create host: 0x%08X\n", hr);
+        MFShutdown();
+        return 1;
+    }
+
+    for (DWORD count : sourceCounts)
+    {
+        SIZE_T before = PrivateBytes();
+        std::vector<com_ptr<MediaSource>> sources(count);
+        for (DWORD i = 0; i < count; i++)
+        {
+            host->CreateSource(nullptr, sources[i].put());
+        }
+        WaitForIdle(sources);
+        SIZE_T idle = PrivateBytes();
+
+        LONGLONG start = OpTrace::Now();
+        for (DWORD op = 0; op < opsPerSource; op++)
+        {
+            for (auto& source : sources)
+            {
+                source->QueueAsyncOperation(Operation::OP_REQUEST_DATA);
+            }
+        }
+        WaitForIdle(sources);
+        LONGLONG elapsed = OpTrace::Now() - start;
+
+        sources.clear();
+        SIZE_T released = PrivateBytes();
+
+        printf("%5u sources: %zu bytes/idle source, %.0f ops/s, %lld bytes not returned after release\n",
+            count, (idle - before) / count, (double)count * opsPerSource * 10000000 / (double)(elapsed > 0 ? elapsed : 1),
+            (LONGLONG)released - (LONGLONG)before);
+    }
+
+    host = nullptr;
+    MFShutdown();
+    return 0;
+}
+
+// MediaSource.exe numa
+// Read throughput of a consumer pinned to node 0 over sample pools allocated
+// on node 0 and on the highest node.
+static int Numa()
+{
+    const DWORD bufferSize = 1 << 20;
+    const DWORD bufferCount = 64;
+    const int passes = 20;
+
+    ULONG highestNode = 0;
+    GetNumaHighestNodeNumber(&highestNode);
+    if (highestNode == 0)
+    {
+        printf("single NUMA node, local and remote runs are the same\n");
+    }
+
+    GROUP_AFFINITY consumerAffinity = {};
+    GetNumaNodeProcessorMaskEx(0, &consumerAffinity);
+    SetThreadGroupAffinity(GetCurrentThread(), &consumerAffinity, NULL);
+
+    MFStartup(MF_VERSION);
+    const USHORT poolNodes[] = { 0, (USHORT)highestNode };
+    for (USHORT poolNode : poolNodes)
+    {
+        auto pool = make_self<SamplePool>(bufferSize, poolNode);
+        pool->Prewarm(bufferCount);
+
+        std::vector<com_ptr<IMFSample>> samples(bufferCount);
+        for (auto& sample : samples)
+        {
+            com_ptr<IMFMediaBuffer> buffer;
+            BYTE* data = nullptr;
+            pool->AcquireSample(sample.put());
+            sample->GetBufferByIndex(0, buffer.put());
+            buffer->Lock(&data, NULL, NULL);
+            memset(data, 1, bufferSize);
+            buffer->Unlock();
+            buffer->SetCurrentLength(bufferSize);
+        }
+
+        uint64_t checksum = 0;
+        LONGLONG start = OpTrace::Now();
+        for (int pass = 0; pass < passes; pass++)
+        {
+            for (auto& sample : samples)
+            {
+                com_ptr<IMFMediaBuffer> buffer;
+                BYTE* data = nullptr;
+                sample->GetBufferByIndex(0, buffer.put());
+                buffer->Lock(&data, NULL, NULL);
+                const uint64_t* words = (const uint64_t*)data;
+                for (DWORD i = 0; i < bufferSize / sizeof(uint64_t); i++)
+                {
+                    checksum += words[i];
+                }
+                buffer->Unlock();
+            }
+        }
+        LONGLONG elapsed = OpTrace::Now() - start;
+        double bytes = (double)bufferSize * bufferCount * passes;
+        printf("consumer node 0, pool node %u: %.2f GB/s (checksum %llu)\n",
+            poolNode, bytes / 1e9 * 10000000 / (double)(elapsed > 0 ? elapsed : 1), checksum);
+    }
+    MFShutdown();
+    return 0;
+}
+
+// MediaSource.exe scan
+// Start-code scan throughput at each instruction set level the CPU supports,
+// against the scalar reference.
+static int Scan()
+{
+    const size_t size = 64 << 20;
+    const size_t nalSize = 64 << 10;
+    const int passes = 10;
+    const char* names[] = { "scalar", "sse2", "avx2" };
+
+    // Random payload with a start code every nalSize bytes, roughly what a
+    // high-bitrate stream looks like to the scanner.
+    std::vector<BYTE> data(size);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < size; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        data[i] = (BYTE)(seed >> 24);
+    }
+    for (size_t i = 0; i + 4 < size; i += nalSize)
+    {
+        data[i] = 0;
+        data[i + 1] = 0;
+        data[i + 2] = 1;
+        data[i + 3] = 0x41;
+    }
+
+    double scalarRate = 0;
+    for (int level = 0; level <= (int)CpuFeatures::GetSimdLevel(); level++)
+    {
+        size_t found = 0;
+        LONGLONG start = OpTrace::Now();
+        for (int pass = 0; pass < passes; pass++)
+        {
+            size_t pos = 0;
+            while (true)
+            {
+                pos += StartCodeScanner::FindWith((SimdLevel)level, data.data() + pos, size - pos);
+                if (pos == size)
+                {
+                    break;
+                }
+                pos += 3;
+                found++;
+            }
+        }
+        LONGLONG elapsed = OpTrace::Now() - start;
+        double rate = (double)size * passes / 1e9 * 10000000 / (double)(elapsed > 0 ? elapsed : 1);
+        if (level == 0)
+        {
+            scalarRate = rate;
+        }
+        printf("%-6s %.2f GB/s (%.1fx scalar, %zu start codes)\n", names[level], rate, rate / scalarRate, found / passes);
+    }
+    return 0;
+}
+
+// MediaSource.exe io <file> [threadpool]
+// IOPS and throughput with many sources reading the same file at once, each
+// through its own StreamReader.
+static int Io(int argc, wchar_t* argv[])
+{
+    if (argc < 3)
+    {
+        printf("usage: MediaSource io <file> [threadpool]\n");
+        return 1;
+    }
+
+    const DWORD sourceCounts[] = { 16, 64, 256 };
+    const DWORD sampleSize = 16 << 10;
+    const DWORD requestSize = 256 << 10;
+    const DWORD maxInFlight = 4;
+    const size_t readAhead = 64;
+    const DWORD durationMs = 5000;
+    bool threadPool = argc > 3 && wcscmp(argv[3], L"threadpool") == 0;
+
+    MFStartup(MF_VERSION);
+    com_ptr<AsyncFile> file;
+    ULONGLONG fileSize = 0;
+    HRESULT hr = AsyncFile::Open(argv[2], threadPool ? IoBackend::THREAD_POOL : IoBackend::OVERLAPPED, file.put());
+    if (SUCCEEDED(hr))
+    {
+        hr = file->GetSize(&fileSize);
+    }
+    if (FAILED(hr) || fileSize < requestSize)
+    {
+        printf("failed to open %ls: 0x%08X\n", argv[2], hr);
+        MFShutdown();
+        return 1;
+    }
+
+    HANDLE ready = CreateEventW(NULL, FALSE, FALSE, NULL);
+    for (DWORD count : sourceCounts)
+    {
+        std::vector<com_ptr<StreamReader>> readers(count);
+        std::vector<ULONGLONG> next(count);
+        for (DWORD i = 0; i < count; i++)
+        {
+            auto pool = make_self<SamplePool>(requestSize);
+            readers[i] = make_self<StreamReader>(file.get(), pool.get(), maxInFlight);
+            readers[i]->SetDataReadyCallback([ready]() { SetEvent(ready); });
+            next[i] = fileSize / count * i / sampleSize * sampleSize;
+        }
+
+        IoCounters before;
+        IoCounters after;
+        AsyncFile::GetCounters(&before);
+        LONGLONG delivered = 0;
+        LONGLONG start = OpTrace::Now();
+        ULONGLONG deadline = GetTickCount64() + durationMs;
+        while (GetTickCount64() < deadline)
+        {
+            for (DWORD i = 0; i < count; i++)
+            {
+                // Each source reads sequentially, wrapping at the end of the file.
+                while (readers[i]->QueuedCount() < readAhead)
+                {
+                    if (next[i] + sampleSize > fileSize)
+                    {
+                        next[i] = 0;
+                    }
+                    readers[i]->Enqueue(next[i], sampleSize, 0, 0, false);
+                    next[i] += sampleSize;
+                }
+                while (true)
+                {
+                    com_ptr<IMFSample> sample;
+                    if (readers[i]->GetCompleted(sample.put()) != S_OK)
+                    {
+                        break;
+                    }
+                    delivered++;
+                }
+            }
+            WaitForSingleObject(ready, 10);
+        }
+        AsyncFile::GetCounters(&after);
+        LONGLONG elapsed = OpTrace::Now() - start;
+
+        ReaderCounters coalescing = {};
+        for (auto& reader : readers)
+        {
+            ReaderCounters counters;
+            reader->GetCounters(&counters);
+            coalescing.requests += counters.requests;
+            coalescing.samples += counters.samples;
+            reader->Cancel();
+        }
+        readers.clear();
+        Sleep(200); // Let reads still in flight drain before the next run.
+
+        double seconds = (double)(elapsed > 0 ? elapsed : 1) / 10000000;
+        printf("%4u sources: %.0f IOPS, %.1f MB/s, %.0f samples/s, %.1f samples/read\n", count,
+            (after.reads - before.reads) / seconds, (after.bytesRead - before.bytesRead) / seconds / 1e6,
+            delivered / seconds, coalescing.requests > 0 ? (double)coalescing.samples / coalescing.requests : 0.0);
+    }
+    CloseHandle(ready);
+    file = nullptr;
+    MFShutdown();
+    return 0;
+}
+
+const DWORD MIX_RATE = 48000;
+const DWORD MIX_CHANNELS = 2;
+const DWORD MIX_BLOCK = 480;
+const DWORD MIX_INPUTS = 64;
+
+// Endless sine tone, produced as fast as it is read.
+class ToneProducer : public SampleProducer
+{
+public:
+    ToneProducer(float frequency) : m_frequency(frequency)
+    {
+    }
+
+    DWORD GetStreamCount() { return 1; }
+    HRESULT GetMediaType(DWORD, IMFMediaType** ppType) { return MixerProducer::CreateFloatAudioType(MIX_RATE, MIX_CHANNELS, ppType); }
+    DWORD GetMaxSampleSize(DWORD) { return MIX_BLOCK * MIX_CHANNELS * sizeof(float); }
+
+    HRESULT ReadSample(DWORD, SamplePool* pPool, IMFSample** ppSample)
+    {
+        HRESULT hr = S_OK;
+        com_ptr<IMFSample> sample;
+        com_ptr<IMFMediaBuffer> buffer;
+        BYTE* data = nullptr;
+        CHECK_HR(hr = pPool->AcquireSample(sample.put()));
+        CHECK_HR(hr = sample->GetBufferByIndex(0, buffer.put()));
+        CHECK_HR(hr = buffer->Lock(&data, NULL, NULL));
+        float* out = (float*)data;
+        for (DWORD i = 0; i < MIX_BLOCK; i++)
+        {
+            float value = sinf(6.2831853f * m_frequency * (float)(m_frame + i) / MIX_RATE);
+            for (DWORD c = 0; c < MIX_CHANNELS; c++)
+            {
+                *out++ = value;
+            }
+        }
+        buffer->Unlock();
+        CHECK_HR(hr = buffer->SetCurrentLength(GetMaxSampleSize(0)));
+        CHECK_HR(hr = sample->SetSampleTime(m_frame * 10000000 / MIX_RATE));
+        CHECK_HR(hr = sample->SetSampleDuration((LONGLONG)MIX_BLOCK * 10000000 / MIX_RATE));
+        m_frame += MIX_BLOCK;
+        *ppSample = sample.detach();
+        return hr;
+    }
+
+private:
+    float m_frequency;
+    LONGLONG m_frame = 0;
+};
+
+static LONGLONG ProcessCpuTime()
+{
+    FILETIME created, exited, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+    return (LONGLONG)(((ULONGLONG)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime) +
+        ((ULONGLONG)user.dwHighDateTime << 32 | user.dwLowDateTime));
+}
+
+static HRESULT WaitForStreamEvent(MediaStream* pStream, MediaEventType type)
+{
+    HRESULT hr = S_OK;
+    while (true)
+    {
+        com_ptr<IMFMediaEvent> event;
+        MediaEventType received = MEUnknown;
+        CHECK_HR(hr = pStream->GetEvent(0, event.put()));
+        CHECK_HR(hr = event->GetType(&received));
+        if (received == type)
+        {
+            return S_OK;
+        }
+        if (received == MEEndOfStream || received == MEError)
+        {
+            return E_FAIL;
+        }
+    }
+}
+
+// MediaSource.exe mix
+// Mixes 64 stereo inputs: the gain-and-sum kernel alone on one pinned core
+// at each instruction set level, then end to end through child sources and
+// a mixer source.
+static int Mix()
+{
+    const DWORD blocks = 1000;
+    const double audioSeconds = (double)blocks * MIX_BLOCK / MIX_RATE;
+    const char* names[] = { "scalar", "sse2", "avx2" };
+
+    GROUP_AFFINITY affinity = {};
+    GetThreadGroupAffinity(GetCurrentThread(), &affinity);
+    affinity.Mask &= (KAFFINITY)0 - affinity.Mask; // Lowest processor only.
+    SetThreadGroupAffinity(GetCurrentThread(), &affinity, NULL);
+
+    const size_t count = (size_t)MIX_BLOCK * MIX_CHANNELS;
+    std::vector<std::vector<float>> inputs(MIX_INPUTS, std::vector<float>(count));
+    std::vector<float> output(count);
+    for (DWORD i = 0; i < MIX_INPUTS; i++)
+    {
+        for (size_t j = 0; j < count; j++)
+        {
+            inputs[i][j] = sinf((float)(i + 1) * (float)j * 0.001f);
+        }
+    }
+
+    for (int level = 0; level <= (int)CpuFeatures::GetSimdLevel(); level++)
+    {
+        LONGLONG start = OpTrace::Now();
+        for (DWORD block = 0; block < blocks; block++)
+        {
+            memset(output.data(), 0, count * sizeof(float));
+            for (DWORD i = 0; i < MIX_INPUTS; i++)
+            {
+                MixKernels::MixWith((SimdLevel)level, output.data(), inputs[i].data(), 1.0f / MIX_INPUTS, count);
+            }
+        }
+        LONGLONG elapsed = OpTrace::Now() - start;
+        double seconds = (double)(elapsed > 0 ? elapsed : 1) / 10000000;
+        printf("kernel %-6s %u inputs: %.0fx realtime on one core\n", names[level], MIX_INPUTS, audioSeconds / seconds);
+    }
+
+    MFStartup(MF_VERSION);
+    auto mixer = make_self<MixerProducer>(MIX_RATE, MIX_CHANNELS, MIX_BLOCK, 200000);
+    for (DWORD i = 0; i < MIX_INPUTS; i++)
+    {
+        com_ptr<MediaSource> child;
+        MediaSource::Create(child.put());
+        child->SetProducer(make_self<ToneProducer>(220.0f + 10.0f * i).get());
+        child->Initialize();
+        mixer->AddInput(child.get(), 1.0f / MIX_INPUTS);
+    }
+
+    com_ptr<MediaSource> source;
+    com_ptr<MediaStream> stream;
+    com_ptr<IMFPresentationDescriptor> pd;
+    PROPVARIANT varStart;
+    PropVariantInit(&varStart);
+    MediaSource::Create(source.put());
+    source->SetProducer(mixer.get());
+    source->Initialize();
+    source->CreatePresentationDescriptor(pd.put());
+    source->Start(pd.get(), NULL, &varStart);
+    source->GetStreamByIndex(0, stream.put());
+
+    HRESULT hr = WaitForStreamEvent(stream.get(), MEStreamStarted);
+    LONGLONG cpuStart = ProcessCpuTime();
+    for (DWORD block = 0; block < blocks && SUCCEEDED(hr); block++)
+    {
+        hr = stream->RequestSample(NULL);
+        if (SUCCEEDED(hr))
+        {
+            hr = WaitForStreamEvent(stream.get(), MEMediaSample);
+        }
+    }
+    LONGLONG cpu = ProcessCpuTime() - cpuStart;
+
+    MixerStats stats;
+    mixer->GetStats(&stats);
+    if (FAILED(hr))
+    {
+        printf("mixer source failed: 0x%08X\n", hr);
+    }
+    else
+    {
+        double cpuSeconds = (double)(cpu > 0 ? cpu : 1) / 10000000;
+        printf("end to end %u inputs: %.1f%% of one core (%.0fx realtime), %lld blocks, %lld late, %lld frames dropped\n",
+            MIX_INPUTS, 100.0 * cpuSeconds / audioSeconds, audioSeconds / cpuSeconds,
+            stats.blocksMixed, stats.blocksLate, stats.framesDropped);
+    }
+
+    source->Shutdown();
+    source = nullptr;
+    stream = nullptr;
+    mixer = nullptr;
+    MFShutdown();
+    return FAILED(hr) ? 1 : 0;
+}
+
+// MediaSource.exe cache <file>
+// 100 sources read the start of one asset at the same time, first through a
+// small private cache each, as if sources shared nothing, then through one
+// shared cache.
+static int Cache(int argc, wchar_t* argv[])
+{
+    if (argc < 3)
+    {
+        printf("usage: MediaSource.exe cache <file>\n");
+        return 1;
+    }
+
+    const DWORD sourceCount = 100;
+    const DWORD rangeSize = 64 << 10;
+    const ULONGLONG maxAssetBytes = 64 << 20;
+
+    MFStartup(MF_VERSION);
+    com_ptr<AsyncFile> file;
+    ULONGLONG fileSize = 0;
+    HRESULT hr = AsyncFile::Open(argv[2], IoBackend::OVERLAPPED, file.put());
+    if (SUCCEEDED(hr))
+    {
+        hr = file->GetSize(&fileSize);
+    }
+    ULONGLONG assetBytes = (std::min)(fileSize, maxAssetBytes) / rangeSize * rangeSize;
+    if (FAILED(hr) || assetBytes == 0)
+    {
+        printf("failed to open %ls: 0x%08X\n", argv[2], hr);
+        MFShutdown();
+        return 1;
+    }
+
+    const char* names[] = { "private", "shared" };
+    for (int shared = 0; shared <= 1; shared++)
+    {
+        auto sharedCache = make_self<ChunkCache>();
+        std::vector<com_ptr<ChunkCache>> caches(sourceCount);
+        std::vector<com_ptr<CachedAsset>> assets(sourceCount);
+        for (DWORD i = 0; i < sourceCount; i++)
+        {
+            caches[i] = shared ? sharedCache : make_self<ChunkCache>(2 * DEFAULT_CACHE_CHUNK_SIZE);
+            assets[i] = make_self<CachedAsset>(caches[i].get(), file.get(), argv[2]);
+        }
+
+        IoCounters before;
+        IoCounters after;
+        AsyncFile::GetCounters(&before);
+        volatile LONG failures = 0;
+        LONGLONG start = OpTrace::Now();
+        std::vector<std::thread> threads;
+        for (DWORD i = 0; i < sourceCount; i++)
+        {
+            threads.emplace_back([&, i]()
+                {
+                    HANDLE done = CreateEventW(NULL, FALSE, FALSE, NULL);
+                    for (ULONGLONG offset = 0; offset < assetBytes; offset += rangeSize)
+                    {
+                        com_ptr<IMFSample> sample;
+                        HRESULT hrRange = S_OK;
+                        HRESULT hrRead = assets[i]->ReadRange(offset, rangeSize, sample.put(),
+                            [&](HRESULT hrComplete, IMFSample* pSample)
+                            {
+                                hrRange = hrComplete;
+                                sample.copy_from(pSample);
+                                SetEvent(done);
+                            });
+                        if (hrRead == E_PENDING)
+                        {
+                            WaitForSingleObject(done, INFINITE);
+                            hrRead = hrRange;
+                        }
+                        if (FAILED(hrRead))
+                        {
+                            InterlockedIncrement(&failures);
+                            break;
+                        }
+                    }
+                    CloseHandle(done);
+                });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        LONGLONG elapsed = OpTrace::Now() - start;
+        AsyncFile::GetCounters(&after);
+
+        ChunkCacheCounters total = {};
+        for (DWORD i = 0; i < (shared ? 1 : sourceCount); i++)
+        {
+            ChunkCacheCounters counters;
+            caches[i]->GetCounters(&counters);
+            total.lookups += counters.lookups;
+            total.hits += counters.hits;
+            total.joins += counters.joins;
+            total.bytesSaved += counters.bytesSaved;
+            total.evictions += counters.evictions;
+        }
+
+        double seconds = (double)(elapsed > 0 ? elapsed : 1) / 10000000;
+        printf("%-7s: %.2f s, %.1f MB read for %.1f MB delivered, hit rate %.1f%% (%lld coalesced), %.1f MB saved, %lld evictions, %ld failed\n",
+            names[shared], seconds, (after.bytesRead - before.bytesRead) / 1e6, (double)assetBytes * sourceCount / 1e6,
+            total.lookups > 0 ? 100.0 * (total.hits + total.joins) / total.lookups : 0.0, total.joins,
+            total.bytesSaved / 1e6, total.evictions, failures);
+    }
+    file = nullptr;
+    MFShutdown();
+    return 0;
+}
+
+static HRESULT CreateEncryptedSample(DWORD size, IMFSample** ppSample)
+{
+    HRESULT hr = S_OK;
+    com_ptr<IMFSample> sample;
+    com_ptr<IMFMediaBuffer> buffer;
+    BYTE* data = nullptr;
+    CHECK_HR(hr = MFCreateSample(sample.put()));
+    CHECK_HR(hr = MFCreateMemoryBuffer(size, buffer.put()));
+    CHECK_HR(hr = buffer->Lock(&data, NULL, NULL));
+    for (DWORD i = 0; i < size; i++)
+    {
+        data[i] = (BYTE)(i * 131 + 7);
+    }
+    buffer->Unlock();
+    CHECK_HR(hr = buffer->SetCurrentLength(size));
+    CHECK_HR(hr = sample->AddBuffer(buffer.get()));
+    *ppSample = sample.detach();
+    return hr;
+}
+
+// A video-like sample: a clear 16-byte header, then one protected range.
+static HRESULT SetEncryption(IMFSample* pSample, DWORD size, bool cbcs)
+{
+    HRESULT hr = S_OK;
+    const BYTE iv[16] = { 0x10, 0x32, 0x54, 0x76, 0x98, 0xba, 0xdc, 0xfe, 0, 0, 0, 0, 0, 0, 0, 0 };
+    const DWORD map[2] = { 16, size - 16 };
+    CHECK_HR(hr = pSample->SetUINT32(MFSampleExtension_Encryption_ProtectionScheme,
+        cbcs ? MF_SAMPLE_ENCRYPTION_PROTECTION_SCHEME_AES_CBC : MF_SAMPLE_ENCRYPTION_PROTECTION_SCHEME_AES_CTR));
+    CHECK_HR(hr = pSample->SetBlob(MFSampleExtension_Encryption_SampleID, iv, cbcs ? 16 : 8));
+    CHECK_HR(hr = pSample->SetBlob(MFSampleExtension_Encryption_SubSample_Mapping, (const UINT8*)map, sizeof(map)));
+    if (cbcs)
+    {
+        CHECK_HR(hr = pSample->SetUINT32(MFSampleExtension_Encryption_CryptByteBlock, 1));
+        CHECK_HR(hr = pSample->SetUINT32(MFSampleExtension_Encryption_SkipByteBlock, 9));
+    }
+    return hr;
+}
+
+// MediaSource.exe decrypt
+// Decrypts 64 KB samples on one pinned core with the scalar AES reference and
+// with AES-NI, for 'cenc' and for 'cbcs' with a 1:9 pattern, then with
+// AES-NI across one decrypt queue per logical processor.
+static int Decrypt()
+{
+    const DWORD sampleSize = 64 << 10;
+    const DWORD sampleCount = 256;
+    const BYTE key[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+
+    MFStartup(MF_VERSION);
+    GROUP_AFFINITY original = {};
+    GROUP_AFFINITY affinity = {};
+    GetThreadGroupAffinity(GetCurrentThread(), &original);
+    affinity = original;
+    affinity.Mask &= (KAFFINITY)0 - affinity.Mask; // Lowest processor only.
+    SetThreadGroupAffinity(GetCurrentThread(), &affinity, NULL);
+
+    std::vector<com_ptr<IMFSample>> samples(sampleCount);
+    for (auto& sample : samples)
+    {
+        CreateEncryptedSample(sampleSize, sample.put());
+    }
+
+    const char* schemes[] = { "cenc", "cbcs 1:9" };
+    for (int aesNi = 0; aesNi <= (CpuFeatures::HasAesNi() ? 1 : 0); aesNi++)
+    {
+        auto decryptor = make_self<CencDecryptor>(aesNi != 0);
+        decryptor->AddKey(GUID_NULL, key);
+        for (int cbcs = 0; cbcs <= 1; cbcs++)
+        {
+            DecryptCounters before;
+            DecryptCounters after;
+            decryptor->GetCounters(&before);
+            LONGLONG start = OpTrace::Now();
+            for (auto& sample : samples)
+            {
+                com_ptr<IMFSample> clear;
+                SetEncryption(sample.get(), sampleSize, cbcs != 0);
+                decryptor->Decrypt(sample.get(), NULL, clear.put());
+            }
+            LONGLONG elapsed = OpTrace::Now() - start;
+            decryptor->GetCounters(&after);
+
+            double seconds = (double)(elapsed > 0 ? elapsed : 1) / 10000000;
+            printf("%-6s %-8s one core: %.2f GB/s decrypted, %.2f GB/s of samples\n", aesNi ? "aes-ni" : "scalar", schemes[cbcs],
+                (after.bytesDecrypted - before.bytesDecrypted) / seconds / 1e9, (double)sampleSize * sampleCount / seconds / 1e9);
+        }
+    }
+    SetThreadGroupAffinity(GetCurrentThread(), &original, NULL);
+
+    // Every stream decrypts its own samples, in place, in parallel.
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    const DWORD streams = info.dwNumberOfProcessors;
+    const DWORD perStream = 64;
+    auto decryptor = make_self<CencDecryptor>();
+    decryptor->AddKey(GUID_NULL, key);
+    HANDLE ready = CreateEventW(NULL, FALSE, FALSE, NULL);
+    std::vector<com_ptr<DecryptQueue>> queues(streams);
+    std::vector<std::vector<com_ptr<IMFSample>>> streamSamples(streams, std::vector<com_ptr<IMFSample>>(perStream));
+    for (DWORD i = 0; i < streams; i++)
+    {
+        queues[i] = make_self<DecryptQueue>(decryptor.get());
+        queues[i]->SetDataReadyCallback([ready]() { SetEvent(ready); });
+        for (auto& sample : streamSamples[i])
+        {
+            CreateEncryptedSample(sampleSize, sample.put());
+            SetEncryption(sample.get(), sampleSize, false);
+        }
+    }
+
+    DecryptCounters before;
+    DecryptCounters after;
+    decryptor->GetCounters(&before);
+    LONGLONG start = OpTrace::Now();
+    for (DWORD j = 0; j < perStream; j++)
+    {
+        for (DWORD i = 0; i < streams; i++)
+        {
+            queues[i]->Submit(streamSamples[i][j].get(), NULL);
+        }
+    }
+    for (DWORD i = 0; i < streams; i++)
+    {
+        while (true)
+        {
+            com_ptr<IMFSample> sample;
+            HRESULT hr = queues[i]->GetCompleted(sample.put());
+            if (hr == E_PENDING)
+            {
+                WaitForSingleObject(ready, 10);
+                continue;
+            }
+            if (hr != S_OK)
+            {
+                break;
+            }
+        }
+    }
+    LONGLONG elapsed = OpTrace::Now() - start;
+    decryptor->GetCounters(&after);
+    CloseHandle(ready);
+
+    double seconds = (double)(elapsed > 0 ? elapsed : 1) / 10000000;
+    double gbps = (after.bytesDecrypted - before.bytesDecrypted) / seconds / 1e9;
+    printf("%-6s cenc     %u streams: %.2f GB/s decrypted, %.2f GB/s per core\n", decryptor->UsesAesNi() ? "aes-ni" : "scalar",
+        streams, gbps, gbps / info.dwNumberOfProcessors);
+
+    queues.clear();
+    samples.clear();
+    streamSamples.clear();
+    MFShutdown();
+    return 0;
+}
+
+// MediaSource.exe rate <file>
+// Plays a synthetic 30 fps stream with a keyframe every second, laid over the
+// file, at 1x, 4x and 16x and reports the bytes read per second of playback.
+// The rate is set unthinned; above the thinning threshold the source thins
+// on its own and only the keyframes are read. The figure next to it is what
+// reading every sample and dropping the rest would cost.
+static int Rate(int argc, wchar_t* argv[])
+{
+    if (argc < 3)
+    {
+        printf("usage: MediaSource.exe rate <file>\n");
+        return 1;
+    }
+
+    const DWORD frameRate = 30;
+    const DWORD keyframeSize = 64 << 10;
+    const DWORD frameSize = 8 << 10;
+    const DWORD requests = 300;
+    const float rates[] = { 1.0f, 4.0f, 16.0f };
+
+    MFStartup(MF_VERSION);
+    com_ptr<AsyncFile> file;
+    ULONGLONG fileSize = 0;
+    HRESULT hr = AsyncFile::Open(argv[2], IoBackend::OVERLAPPED, file.put());
+    if (SUCCEEDED(hr))
+    {
+        hr = file->GetSize(&fileSize);
+    }
+    if (FAILED(hr))
+    {
+        printf("failed to open %ls: 0x%08X\n", argv[2], hr);
+        MFShutdown();
+        return 1;
+    }
+
+    // Frames back to back from the start of the file.
+    std::vector<IndexEntry> index;
+    ULONGLONG offset = 0;
+    for (LONGLONG frame = 0;; frame++)
+    {
+        bool keyframe = frame % frameRate == 0;
+        DWORD length = keyframe ? keyframeSize : frameSize;
+        if (offset + length > fileSize)
+        {
+            break;
+        }
+        index.push_back({ offset, length, frame * 10000000 / frameRate, 10000000 / frameRate, keyframe });
+        offset += length;
+    }
+    if (index.size() < (size_t)frameRate * 2)
+    {
+        printf("%ls is too small\n", argv[2]);
+        MFShutdown();
+        return 1;
+    }
+
+    com_ptr<IMFMediaType> type;
+    MFCreateMediaType(type.put());
+    type->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+    type->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264);
+
+    for (float rate : rates)
+    {
+        auto producer = make_self<IndexedFileProducer>(file.get(), type.get(), index);
+        com_ptr<MediaSource> source;
+        com_ptr<MediaStream> stream;
+        com_ptr<IMFPresentationDescriptor> pd;
+        PROPVARIANT varStart;
+        PropVariantInit(&varStart);
+        MediaSource::Create(source.put());
+        source->SetProducer(producer.get());
+        source->Initialize();
+        source->SetRate(FALSE, rate);
+        source->CreatePresentationDescriptor(pd.put());
+        source->Start(pd.get(), NULL, &varStart);
+        source->GetStreamByIndex(0, stream.put());
+
+        hr = WaitForStreamEvent(stream.get(), MEStreamStarted);
+        LONGLONG first = -1;
+        LONGLONG last = 0;
+        for (DWORD i = 0; i < requests && SUCCEEDED(hr); i++)
+        {
+            com_ptr<IMFMediaEvent> event;
+            MediaEventType received = MEUnknown;
+            hr = stream->RequestSample(NULL);
+            while (SUCCEEDED(hr) && received != MEMediaSample && received != MEEndOfStream)
+            {
+                event = nullptr;
+                hr = stream->GetEvent(0, event.put());
+                if (SUCCEEDED(hr))
+                {
+                    hr = event->GetType(&received);
+                }
+                if (received == MEError)
+                {
+                    hr = E_FAIL;
+                }
+            }
+            if (received == MEEndOfStream)
+            {
+                break;
+            }
+
+            PROPVARIANT var;
+            PropVariantInit(&var);
+            com_ptr<IMFSample> sample;
+            LONGLONG time = 0;
+            if (SUCCEEDED(hr) && SUCCEEDED(event->GetValue(&var)) && var.vt == VT_UNKNOWN &&
+                SUCCEEDED(var.punkVal->QueryInterface(IID_PPV_ARGS(sample.put()))) &&
+                SUCCEEDED(sample->GetSampleTime(&time)))
+            {
+                first = first < 0 ? time : first;
+                last = time;
+            }
+            PropVariantClear(&var);
+        }
+
+        LONGLONG bytesRead = stream->GetBytesRead();
+        source->Shutdown();
+        if (FAILED(hr) || last <= first)
+        {
+            printf("%4.0fx: playback failed: 0x%08X\n", rate, hr);
+            continue;
+        }
+
+        LONGLONG streamBytes = 0;
+        for (const IndexEntry& entry : index)
+        {
+            if (entry.time >= first && entry.time <= last)
+            {
+                streamBytes += entry.length;
+            }
+        }
+        double seconds = (double)(last - first) / 10000000 / rate;
+        printf("%4.0fx: %.2f MB/s read, %.2f MB/s reading every sample\n", rate,
+            bytesRead / seconds / 1e6, streamBytes / seconds / 1e6);
+    }
+
+    file = nullptr;
+    MFShutdown();
+    return 0;
+}
+
+const DWORD FRAME_RATE = 30;
+const DWORD FRAME_KEY_SIZE = 64 << 10;
+const DWORD FRAME_DELTA_SIZE = 8 << 10;
+
+// Endless 30 fps video streams with a keyframe every second, produced as fast
+// as they are read. The payload is left as whatever the pool holds.
+class FrameProducer : public SampleProducer
+{
+public:
+    FrameProducer(DWORD streamCount) : m_frames(streamCount)
+    {
+    }
+
+    DWORD GetStreamCount() { return (DWORD)m_frames.size(); }
+    DWORD GetMaxSampleSize(DWORD) { return FRAME_KEY_SIZE; }
+
+    HRESULT GetMediaType(DWORD, IMFMediaType** ppType)
+    {
+        HRESULT hr = S_OK;
+        com_ptr<IMFMediaType> type;
+        CHECK_HR(hr = MFCreateMediaType(type.put()));
+        CHECK_HR(hr = type->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
+        CHECK_HR(hr = type->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264));
+        *ppType = type.detach();
+        return hr;
+    }
+
+    HRESULT ReadSample(DWORD streamIndex, SamplePool* pPool, IMFSample** ppSample)
+    {
+        HRESULT hr = S_OK;
+        com_ptr<IMFSample> sample;
+        com_ptr<IMFMediaBuffer> buffer;
+        LONGLONG frame = m_frames[streamIndex]++;
+        bool keyframe = frame % FRAME_RATE == 0;
+        CHECK_HR(hr = pPool->AcquireSample(sample.put()));
+        CHECK_HR(hr = sample->GetBufferByIndex(0, buffer.put()));
+        CHECK_HR(hr = buffer->SetCurrentLength(keyframe ? FRAME_KEY_SIZE : FRAME_DELTA_SIZE));
+        CHECK_HR(hr = sample->SetSampleTime(frame * 10000000 / FRAME_RATE));
+        CHECK_HR(hr = sample->SetSampleDuration(10000000 / FRAME_RATE));
+        if (keyframe)
+        {
+            CHECK_HR(hr = sample->SetUINT32(MFSampleExtension_CleanPoint, TRUE));
+        }
+        *ppSample = sample.detach();
+        return hr;
+    }
+
+private:
+    std::vector<LONGLONG> m_frames;
+};
+
+// MediaSource.exe timeshift
+// Plays two minutes of a 30 fps stream into a time-shift window that keeps
+// 16 MB in memory and spills the rest, reports the window's memory per
+// minute, then seeks back into the in-memory part and into the spilled part
+// and reports how long the first replayed sample took.
+static int TimeShift()
+{
+    const LONGLONG minute = 600000000;
+    const DWORD frames = FRAME_RATE * 120;
+    const SIZE_T ramThreshold = 16 << 20;
+    const SIZE_T spillCapacity = 256 << 20;
+    const LONGLONG seekBack[] = { 10 * 10000000LL, 90 * 10000000LL };
+
+    MFStartup(MF_VERSION);
+    com_ptr<MediaSource> source;
+    com_ptr<MediaStream> stream;
+    com_ptr<IMFPresentationDescriptor> pd;
+    PROPVARIANT varStart;
+    PropVariantInit(&varStart);
+    MediaSource::Create(source.put());
+    source->SetProducer(make_self<FrameProducer>(1).get());
+    source->Initialize();
+    source->EnableTimeShift(10 * minute, ramThreshold, spillCapacity);
+    source->CreatePresentationDescriptor(pd.put());
+    source->Start(pd.get(), NULL, &varStart);
+    source->GetStreamByIndex(0, stream.put());
+
+    HRESULT hr = WaitForStreamEvent(stream.get(), MEStreamStarted);
+    for (DWORD i = 0; i < frames && SUCCEEDED(hr); i++)
+    {
+        hr = stream->RequestSample(NULL);
+        if (SUCCEEDED(hr))
+        {
+            hr = WaitForStreamEvent(stream.get(), MEMediaSample);
+        }
+    }
+
+    TimeShiftStats stats;
+    stream->GetTimeShiftStats(&stats);
+    if (FAILED(hr) || stats.bufferedDuration <= 0)
+    {
+        printf("filling the window failed: 0x%08X\n", hr);
+    }
+    else
+    {
+        printf("window %.1f min: %.1f MB/min (%.1f MB/min in memory, %.1f MB/min spilled)\n",
+            (double)stats.bufferedDuration / minute, stats.BytesPerMinute() / 1e6,
+            (double)stats.ramBytes * minute / stats.bufferedDuration / 1e6,
+            (double)stats.spilledBytes * minute / stats.bufferedDuration / 1e6);
+    }
+
+    // The newest delivered sample is the last one requested, and the newest
+    // part of the window is the part still in memory.
+    const LONGLONG newest = (LONGLONG)(frames - 1) * 10000000 / FRAME_RATE;
+    const SIZE_T heldBytes = stats.ramBytes + stats.spilledBytes;
+    const LONGLONG inMemory = heldBytes > 0 ? (LONGLONG)((double)stats.bufferedDuration * stats.ramBytes / heldBytes) : 0;
+    for (LONGLONG back : seekBack)
+    {
+        if (FAILED(hr))
+        {
+            break;
+        }
+        PROPVARIANT varSeek;
+        PropVariantInit(&varSeek);
+        varSeek.vt = VT_I8;
+        varSeek.hVal.QuadPart = newest - back;
+
+        LONGLONG start = OpTrace::Now();
+        hr = source->Start(pd.get(), NULL, &varSeek);
+        if (SUCCEEDED(hr))
+        {
+            hr = WaitForStreamEvent(stream.get(), MEStreamSeeked);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = stream->RequestSample(NULL);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = WaitForStreamEvent(stream.get(), MEMediaSample);
+        }
+        LONGLONG elapsed = OpTrace::Now() - start;
+        stream->GetTimeShiftStats(&stats);
+        if (FAILED(hr))
+        {
+            printf("seek back %llds failed: 0x%08X\n", back / 10000000, hr);
+            break;
+        }
+        printf("seek back %3llds (%s): %lldus to the first sample, %lldus of it in the stream\n",
+            back / 10000000, back <= inMemory ? "memory" : "spilled",
+            elapsed / 10, stats.lastSeekLatency / 10);
+    }
+
+    source->Shutdown();
+    source = nullptr;
+    stream = nullptr;
+    MFShutdown();
+    return FAILED(hr) ? 1 : 0;
+}
+
+// MediaSource.exe select
+// Plays the first of two streams, then selects the second as well with a
+// reselect (empty start position) while still pulling the first. Reports the
+// new stream's time to its first sample and the longest delivery gap on the
+// untouched stream across the reselect.
+static int Select()
+{
+    const DWORD before = FRAME_RATE * 2;
+    const DWORD after = FRAME_RATE * 2;
+
+    MFStartup(MF_VERSION);
+    com_ptr<MediaSource> source;
+    com_ptr<MediaStream> kept;
+    com_ptr<MediaStream> added;
+    com_ptr<IMFPresentationDescriptor> pd;
+    PROPVARIANT varStart;
+    PropVariantInit(&varStart);
+    MediaSource::Create(source.put());
+    source->SetProducer(make_self<FrameProducer>(2).get());
+    source->Initialize();
+    source->CreatePresentationDescriptor(pd.put());
+    pd->DeselectStream(1);
+    source->Start(pd.get(), NULL, &varStart);
+    source->GetStreamByIndex(0, kept.put());
+    source->GetStreamByIndex(1, added.put());
+
+    HRESULT hr = WaitForStreamEvent(kept.get(), MEStreamStarted);
+    for (DWORD i = 0; i < before && SUCCEEDED(hr); i++)
+    {
+        hr = kept->RequestSample(NULL);
+        if (SUCCEEDED(hr))
+        {
+            hr = WaitForStreamEvent(kept.get(), MEMediaSample);
+        }
+    }
+
+    // Reselect with both streams. The first stream keeps its queue and gets
+    // no new events; the second is activated and started.
+    if (SUCCEEDED(hr))
+    {
+        hr = pd->SelectStream(1);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = source->Start(pd.get(), NULL, &varStart);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = added->RequestSample(NULL);
+    }
+    for (DWORD i = 0; i < after && SUCCEEDED(hr); i++)
+    {
+        hr = kept->RequestSample(NULL);
+        if (SUCCEEDED(hr))
+        {
+            hr = WaitForStreamEvent(kept.get(), MEMediaSample);
+        }
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = WaitForStreamEvent(added.get(), MEMediaSample);
+    }
+
+    // Anything left on the untouched stream was queued by the reselect.
+    DWORD restarted = 0;
+    while (SUCCEEDED(hr))
+    {
+        com_ptr<IMFMediaEvent> event;
+        MediaEventType type = MEUnknown;
+        if (FAILED(kept->GetEvent(MF_EVENT_FLAG_NO_WAIT, event.put())))
+        {
+            break;
+        }
+        event->GetType(&type);
+        if (type == MEStreamStarted)
+        {
+            restarted++;
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        printf("reselect failed: 0x%08X\n", hr);
+    }
+    else
+    {
+        SelectionStats addedStats;
+        SelectionStats keptStats;
+        added->GetSelectionStats(&addedStats);
+        kept->GetSelectionStats(&keptStats);
+        printf("new stream: %lldus to the first sample\n", addedStats.timeToFirstSample / 10);
+        printf("untouched stream: %lldus longest delivery gap, %u restart events\n",
+            keptStats.maxDeliveryGap / 10, restarted);
+    }
+
+    source->Shutdown();
+    source = nullptr;
+    kept = nullptr;
+    added = nullptr;
+    MFShutdown();
+    return FAILED(hr) ? 1 : 0;
+}
+
+int wmain(int argc, wchar_t* argv[])
 {
     init_apartment();
+    if (argc > 1 && wcscmp(argv[1], L"replay") == 0)
+    {
+        return Replay(argc, argv);
+    }
+    if (argc > 1 && wcscmp(argv[1], L"density") == 0)
+    {
+        return Density();
+    }
+    if (argc > 1 && wcscmp(argv[1], L"numa") == 0)
+    {
+        return Numa();
+    }
+    if (argc > 1 && wcscmp(argv[1], L"scan") == 0)
+    {
+        return Scan();
+    }
+    if (argc > 1 && wcscmp(argv[1], L"io") == 0)
+    {
+        return Io(argc, argv);
+    }
+    if (argc > 1 && wcscmp(argv[1], L"mix") == 0)
+    {
+        return Mix();
+    }
+    if (argc > 1 && wcscmp(argv[1], L"cache") == 0)
+    {
+        return Cache(argc, argv);
+    }
+    if (argc > 1 && wcscmp(argv[1], L"decrypt") == 0)
+    {
+        return Decrypt();
+    }
+    if (argc > 1 && wcscmp(argv[1], L"rate") == 0)
+    {
+        return Rate(argc, argv);
+    }
+    if (argc > 1 && wcscmp(argv[1], L"timeshift") == 0)
+    {
+        return TimeShift();
+    }
+    if (argc > 1 && wcscmp(argv[1], L"select") == 0)
+    {
+        return Select();
+    }
+
     Uri uri(L"http://aka.ms/cppwinrt");
     printf("Hello, %ls!\n", uri.AbsoluteUri().c_str());
+    return 0;
 }
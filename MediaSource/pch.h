@@ -13,4 +13,19 @@ enum class SourceState
     STATE_SHUTDOWN
 };
 
+// Critical section shared by a source, its streams and its OpQueue. Streams
+// and the OpQueue hold it by reference count so it outlives whichever of them
+// goes last.
+class SourceLock : public winrt::implements<SourceLock, IUnknown>
+{
+public:
+    SourceLock() { InitializeCriticalSectionEx(&m_critSec, 0, CRITICAL_SECTION_NO_DEBUG_INFO); }
+    ~SourceLock() { DeleteCriticalSection(&m_critSec); }
+
+    CRITICAL_SECTION& Get() { return m_critSec; }
+
+private:
+    CRITICAL_SECTION m_critSec;
+};
+
 #define CHECK_HR(hr) if(FAILED(hr)) return hr;
\ No newline at end of file